@@ -0,0 +1,133 @@
+/* Hashtable implementation code
+ * Chained buckets give O(1) add/find/pop by key, a doubly linked
+ * list through all nodes keeps a stable iteration order */
+
+#define MEM_TAG MEM_JOBS
+
+#include <stdio.h>
+#include <assert.h>
+
+#include "ADThashtable.h"
+#include "utils.h"
+
+#define ADT_HASH_MIN_SIZE 16
+
+/* Fibonacci hashing, spreads sequential pids across buckets */
+static unsigned int hash_key(int key, int size){
+    return ((unsigned int) key * 2654435761u) & (unsigned int) (size - 1);
+}
+
+/* Rebuild bucket chains with a new bucket count, iteration order is unchanged */
+static void resize_table(ADThashtable * table, int size){
+    ADThashnode ** buckets = xmalloc(sizeof(ADThashnode *) * size);
+    int i;
+    for( i=0; i < size; i++) buckets[i] = NULL;
+
+    ADThashnode * node = table->head;
+    while(node){
+        unsigned int bucket = hash_key(node->key, size);
+        node->chain = buckets[bucket];
+        buckets[bucket] = node;
+        node = node->next;
+    }
+
+    if(table->buckets) xfree(table->buckets);
+    table->buckets = buckets;
+    table->size = size;
+}
+
+/* Initiate the hashtable structure to safe default values */
+void adtInitiateHashTable(ADThashtable * table){
+    table->num = 0;
+    table->size = 0;
+    table->buckets = NULL;
+    table->head = NULL;
+}
+
+/* Free the buckets of the table. Nodes are not touched and must be popped first */
+void adtFreeHashTable(ADThashtable * table){
+    assert(table);
+    if(table->buckets) xfree(table->buckets);
+    adtInitiateHashTable(table);
+}
+
+/*Initiate the structure of a node to safe values with key and val set */
+void adtInitiateHashNode(ADThashnode * node, int key, void * val){
+    node->key = key;
+    node->val = val;
+    node->chain = NULL;
+    node->next = NULL;
+    node->prev = NULL;
+}
+
+/*Add node to the table, in front of the iteration order. 
+ * Returns -1 on failure (key already present). 0 otherwise*/
+int adtAddHashNode(ADThashtable * table, ADThashnode * node){
+    assert(table);
+    if( adtFindHashNode(table, node->key) ){
+        return -1;
+    }
+
+    if( table->size == 0 ){
+        resize_table(table, ADT_HASH_MIN_SIZE);
+    }else if( table->num + 1 > table->size - table->size / 4 ){ //keep load under 0.75
+        resize_table(table, table->size * 2);
+    }
+
+    unsigned int bucket = hash_key(node->key, table->size);
+    node->chain = table->buckets[bucket];
+    table->buckets[bucket] = node;
+
+    node->prev = NULL;
+    node->next = table->head;
+    if(table->head) table->head->prev = node;
+    table->head = node;
+
+    table->num += 1;
+    return 0;
+}
+
+/* Find the node with the given key, freeing will cauce corruption in the table
+ * Returns NULL if not found 
+ * */
+ADThashnode * adtFindHashNode(ADThashtable * table, int key){
+    assert(table);
+    if( table->num == 0 ){
+        return NULL;
+    }
+
+    ADThashnode * node = table->buckets[hash_key(key, table->size)];
+    while(node){
+        if( node->key == key ) return node;
+        node = node->chain;
+    }
+
+    return NULL;
+}
+
+/*Remove node with the given key from table. Caller responsible for free. 
+ * Returns NULL if not found*/
+ADThashnode * adtPopHashNode(ADThashtable * table, int key){
+    assert(table);
+    if( table->num == 0 ){
+        return NULL;
+    }
+
+    ADThashnode * * link = &table->buckets[hash_key(key, table->size)];
+    while(*link && (*link)->key != key) link = &(*link)->chain;
+
+    ADThashnode * popped = *link;
+    if( !popped ) return NULL;
+    *link = popped->chain;
+
+    if(popped->prev) popped->prev->next = popped->next;
+    else table->head = popped->next;
+    if(popped->next) popped->next->prev = popped->prev;
+
+    popped->chain = NULL; //defensive
+    popped->next = NULL;
+    popped->prev = NULL;
+    table->num -= 1;
+
+    return popped;
+}
@@ -0,0 +1,49 @@
+/* Hashtable header, nodes are keyed by an int (pid) */
+
+#ifndef _ADTHASHTABLE_H
+#define _ADTHASHTABLE_H
+
+#include <stdio.h>
+
+typedef struct ADThashnode{
+    int key;
+    void * val;
+    struct ADThashnode * chain; //next node in the same bucket
+    struct ADThashnode * next; //iteration order, newest node first
+    struct ADThashnode * prev;
+} ADThashnode;
+
+typedef struct ADThashtable{
+    int num; //number of ellements
+    int size; //number of buckets, always zero or a power of two
+    struct ADThashnode ** buckets;
+    struct ADThashnode * head; //newest node, iteration starts here
+}ADThashtable;
+
+
+//caller responsible for all node memory free/allocations, the table only owns its buckets
+
+/* Initiate the hashtable structure to safe default values */
+void adtInitiateHashTable(ADThashtable * table);
+
+/* Free the buckets of the table. Nodes are not touched and must be popped first */
+void adtFreeHashTable(ADThashtable * table);
+
+/*Initiate the structure of a node to safe values with key and val set */
+void adtInitiateHashNode(ADThashnode * node, int key, void * val);
+
+/*Add node to the table, in front of the iteration order. 
+ * Returns -1 on failure (key already present). 0 otherwise*/
+int adtAddHashNode(ADThashtable * table, ADThashnode * node);
+
+/* Find the node with the given key, freeing will cauce corruption in the table
+ * Returns NULL if not found 
+ * */
+ADThashnode * adtFindHashNode(ADThashtable * table, int key);
+
+/*Remove node with the given key from table. Caller responsible for free. 
+ * Returns NULL if not found*/
+ADThashnode * adtPopHashNode(ADThashtable * table, int key);
+
+
+#endif
@@ -0,0 +1,76 @@
+/* Pool implementation code */
+
+#define MEM_TAG MEM_JOBS
+
+#include <stdio.h>
+#include <assert.h>
+
+#include "ADTpool.h"
+#include "utils.h"
+
+/* Initiate the pool for objects of size bytes, allocated per_slab at a time */
+void adtInitiatePool(ADTpool * pool, size_t size, int per_slab){
+    assert(per_slab > 0);
+    size_t align = sizeof(void *) > sizeof(double) ? sizeof(void *) : sizeof(double);
+    if(size < sizeof(void *)) size = sizeof(void *);
+    pool->size = (size + align - 1) / align * align;
+    pool->per_slab = per_slab;
+    pool->used = 0;
+    pool->capacity = 0;
+    pool->slabs = 0;
+    pool->free = NULL;
+    pool->head = NULL;
+}
+
+/* Free all slabs. Objects still in use become invalid */
+void adtFreePool(ADTpool * pool){
+    assert(pool);
+    while(pool->head){
+        ADTpoolslab * slab = pool->head;
+        pool->head = slab->next;
+        xfree(slab);
+    }
+    adtInitiatePool(pool, pool->size, pool->per_slab);
+}
+
+/* Thread the objects of a new slab onto the free list */
+static void add_slab(ADTpool * pool){
+    size_t header = (sizeof(ADTpoolslab) + pool->size - 1) / pool->size * pool->size; //keeps objects aligned
+    ADTpoolslab * slab = xmalloc(header + pool->size * pool->per_slab);
+    slab->next = pool->head;
+    pool->head = slab;
+
+    char * object = (char *) slab + header;
+    int i;
+    for( i = 0; i < pool->per_slab; i++){
+        *(void * *) object = pool->free;
+        pool->free = object;
+        object += pool->size;
+    }
+
+    pool->capacity += pool->per_slab;
+    pool->slabs += 1;
+}
+
+/* Take an object from the pool, adding a slab when it is full. O(1)
+ * Aborts program on failure */
+void * adtPoolAlloc(ADTpool * pool){
+    assert(pool);
+    if( !pool->free ){
+        add_slab(pool);
+    }
+
+    void * object = pool->free;
+    pool->free = *(void * *) object;
+    pool->used += 1;
+    return object;
+}
+
+/* Return an object to the pool. O(1) */
+void adtPoolFree(ADTpool * pool, void * object){
+    assert(pool);
+    assert(object);
+    *(void * *) object = pool->free;
+    pool->free = object;
+    pool->used -= 1;
+}
@@ -0,0 +1,39 @@
+/* Pool header, a slab allocator for objects of one fixed size */
+
+#ifndef _ADTPOOL_H
+#define _ADTPOOL_H
+
+#include <stdio.h>
+
+typedef struct ADTpoolslab{
+    struct ADTpoolslab * next;
+} ADTpoolslab; //followed by per_slab objects
+
+typedef struct ADTpool{
+    size_t size; //object size, rounded up to hold a free list link
+    int per_slab; //objects in each slab
+    int used; //objects handed out
+    int capacity; //objects in all slabs
+    int slabs;
+    void * free; //free list threaded through unused objects
+    struct ADTpoolslab * head; //all slabs, for adtFreePool
+} ADTpool;
+
+
+//slabs are only released by adtFreePool, so alloc and free never touch malloc once warm
+
+/* Initiate the pool for objects of size bytes, allocated per_slab at a time */
+void adtInitiatePool(ADTpool * pool, size_t size, int per_slab);
+
+/* Free all slabs. Objects still in use become invalid */
+void adtFreePool(ADTpool * pool);
+
+/* Take an object from the pool, adding a slab when it is full. O(1)
+ * Aborts program on failure */
+void * adtPoolAlloc(ADTpool * pool);
+
+/* Return an object to the pool. O(1) */
+void adtPoolFree(ADTpool * pool, void * object);
+
+
+#endif
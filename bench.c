@@ -0,0 +1,494 @@
+/* Benchmarks for pman hot paths. Run with "make bench"
+ * Every bench uses fixed inputs and counts so runs can be compared,
+ * latencies are reported as p50/p99/max of the measured samples */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <regex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "ADTlinkedlist.h"
+#include "ADThashtable.h"
+#include "commands.h"
+#include "output.h"
+#include "procstat.h"
+#include "spawn.h"
+#include "utils.h"
+
+#define BENCH_SPAWNS 300 //create_process calls per backend
+#define BENCH_BULK_ROUNDS 6
+#define BENCH_BULK_JOBS 50 //jobs per create_processes call
+#define BENCH_SIGNAL_JOBS 1000 //job table for signal and stats benches
+#define BENCH_SIGNAL_ROUNDS 20
+#define BENCH_LOOKUPS 1000 //lookups per sample
+#define BENCH_LOOKUP_SAMPLES 50
+#define BENCH_TOKEN_CALLS 100000
+#define BENCH_CHILDREN 64
+#define BENCH_ROUNDS 200
+#define BENCH_TABLE_JOBS 5000 //job table size for the parallel bench
+#define BENCH_TABLE_ROUNDS 5
+
+/* Latency samples of one bench, in nanoseconds */
+typedef struct samples {
+    double * ns;
+    int num;
+    int size;
+} samples;
+
+/* Monotonic time in nanoseconds */
+static double now_ns(void) {
+    return monotonic_seconds() * 1e9;
+}
+
+static void samples_init(samples * s) {
+    s->size = 64;
+    s->num = 0;
+    s->ns = xmalloc(sizeof(double) * s->size);
+}
+
+static void samples_add(samples * s, double ns) {
+    if(s->num == s->size) {
+        s->size *= 2;
+        s->ns = xrealloc(s->ns, sizeof(double) * s->size);
+    }
+    s->ns[s->num++] = ns;
+}
+
+static int compare_doubles(const void * val1, const void * val2) {
+    double d1 = *(const double *) val1;
+    double d2 = *(const double *) val2;
+    return (d1 > d2) - (d1 < d2);
+}
+
+/* Prints one row of a result table and frees the samples */
+static void report(const char * name, samples * s) {
+    qsort(s->ns, s->num, sizeof(double), compare_doubles);
+    double total = 0;
+    int i;
+    for(i = 0; i < s->num; i++) total += s->ns[i];
+    double p50 = s->ns[s->num / 2];
+    double p99 = s->ns[(int) (s->num * 0.99) < s->num ? (int) (s->num * 0.99) : s->num - 1];
+    printf("  %-34s %7d %11.2f %11.2f %11.2f %12.0f\n", name, s->num, p50 / 1e3, p99 / 1e3,
+           s->ns[s->num - 1] / 1e3, s->num / (total / 1e9));
+    xfree(s->ns);
+}
+
+static void table_header(const char * title) {
+    printf("\n%s\n  %-34s %7s %11s %11s %11s %12s\n", title, "bench", "samples", "p50(us)", "p99(us)",
+           "max(us)", "ops/s");
+}
+
+/* Commands print their results, send them to /dev/null while measuring */
+static int saved_stdout = -1;
+
+static void quiet(void) {
+    out_flush();
+    fflush(stdout);
+    saved_stdout = dup(STDOUT_FILENO);
+    int fd = open("/dev/null", O_WRONLY);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+}
+
+static void loud(void) {
+    out_flush(); //command output is buffered until a flush
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+}
+
+/* Kills every active job and frees the whole table */
+static void drain_jobs(jobtable * jobs) {
+    ADThashnode * node;
+    for(node = jobs->active.head; node; node = node->next) kill(node->key, SIGKILL);
+    ADThashtable * tables[] = {&jobs->active, &jobs->exited};
+    int i;
+    for(i = 0; i < 2; i++) {
+        while(tables[i]->num > 0) {
+            node = adtPopHashNode(tables[i], tables[i]->head->key);
+            if(i == 0) waitpid(node->key, NULL, 0);
+            free_node(node);
+        }
+    }
+}
+
+/* Pid strings of all active jobs, null terminated, as the commands take them */
+static char * * job_tokens(jobtable * jobs) {
+    char * * tokens = xmalloc(sizeof(char *) * (jobs->active.num + 1));
+    int num = 0;
+    ADThashnode * node;
+    for(node = jobs->active.head; node; node = node->next) {
+        tokens[num] = xmalloc(16);
+        snprintf(tokens[num++], 16, "%d", node->key);
+    }
+    tokens[num] = NULL;
+    return tokens;
+}
+
+/* Spawn latency and throughput of create_process for each backend,
+ * and of create_processes (bgmany) per job */
+static void bench_spawn(jobtable * jobs) {
+    char * args[] = {"true", NULL};
+    int backend;
+
+    table_header("spawn (program: true)");
+    for(backend = SPAWN_FORK; backend <= SPAWN_POSIX; backend++) {
+        spawn_set_backend(backend);
+        samples s;
+        samples_init(&s);
+        char name[64];
+        int i;
+
+        quiet();
+        for(i = 0; i < BENCH_SPAWNS; i++) {
+            double start = now_ns();
+            create_process(jobs, args);
+            samples_add(&s, now_ns() - start);
+        }
+        loud();
+        drain_jobs(jobs);
+        snprintf(name, sizeof(name), "create_process %s", spawn_backend_name(backend));
+        report(name, &s);
+
+        char * * * specs = xmalloc(sizeof(char * *) * (BENCH_BULK_JOBS + 1));
+        for(i = 0; i < BENCH_BULK_JOBS; i++) specs[i] = args;
+        specs[BENCH_BULK_JOBS] = NULL;
+        samples_init(&s);
+        quiet();
+        for(i = 0; i < BENCH_BULK_ROUNDS; i++) {
+            double start = now_ns();
+            create_processes(jobs, specs, NULL);
+            samples_add(&s, (now_ns() - start) / BENCH_BULK_JOBS);
+        }
+        loud();
+        drain_jobs(jobs);
+        xfree(specs);
+        snprintf(name, sizeof(name), "create_processes %s, per job", spawn_backend_name(backend));
+        report(name, &s);
+    }
+    spawn_set_backend(SPAWN_POSIX);
+}
+
+/* Signal fan-out of send_signal and per pid cost of print_stats over a job table */
+static void bench_signal_stats(jobtable * jobs) {
+    char * args[] = {"sleep", "600", NULL};
+    char * * * specs = xmalloc(sizeof(char * *) * (BENCH_SIGNAL_JOBS + 1));
+    int i;
+    for(i = 0; i < BENCH_SIGNAL_JOBS; i++) specs[i] = args;
+    specs[BENCH_SIGNAL_JOBS] = NULL;
+    quiet();
+    create_processes(jobs, specs, NULL);
+    loud();
+    xfree(specs);
+
+    char * * tokens = job_tokens(jobs);
+    char title[64];
+    snprintf(title, sizeof(title), "job table commands (%d jobs)", jobs->active.num);
+    table_header(title);
+
+    samples calls, pids;
+    samples_init(&calls);
+    samples_init(&pids);
+    quiet();
+    for(i = 0; i < BENCH_SIGNAL_ROUNDS; i++) {
+        double start = now_ns();
+        send_signal(jobs, tokens, i % 2 ? SIGCONT : SIGSTOP);
+        double elapsed = now_ns() - start;
+        samples_add(&calls, elapsed);
+        samples_add(&pids, elapsed / jobs->active.num);
+    }
+    if(BENCH_SIGNAL_ROUNDS % 2) send_signal(jobs, tokens, SIGCONT);
+    loud();
+    report("send_signal, per call", &calls);
+    report("send_signal, per pid", &pids);
+
+    samples_init(&calls);
+    samples_init(&pids);
+    quiet();
+    for(i = 0; i < BENCH_SIGNAL_ROUNDS / 4; i++) {
+        double start = now_ns();
+        print_stats(jobs, tokens);
+        double elapsed = now_ns() - start;
+        samples_add(&calls, elapsed);
+        samples_add(&pids, elapsed / jobs->active.num);
+    }
+    loud();
+    report("print_stats, per call", &calls);
+    report("print_stats, per pid", &pids);
+
+    for(i = 0; tokens[i]; i++) xfree(tokens[i]);
+    xfree(tokens);
+    drain_jobs(jobs);
+}
+
+/* Lookup cost against job count, pid table against the linked list it replaced */
+static int compare_keys(void * val1, void * val2) {
+    return *(int *) val1 == *(int *) val2;
+}
+
+static void bench_lookup(void) {
+    int sizes[] = {16, 256, 4096, 65536};
+    int s_index, i, sample;
+
+    table_header("job lookup by pid, per lookup");
+    for(s_index = 0; s_index < (int) (sizeof(sizes) / sizeof(sizes[0])); s_index++) {
+        int num = sizes[s_index];
+        int * keys = xmalloc(sizeof(int) * num);
+        ADThashnode * hash_nodes = xmalloc(sizeof(ADThashnode) * num);
+        ADTlinkednode * list_nodes = xmalloc(sizeof(ADTlinkednode) * num);
+        ADThashtable table;
+        ADTlinkedlist list;
+        adtInitiateHashTable(&table);
+        adtInitiateLinkedList(&list);
+        for(i = 0; i < num; i++) {
+            keys[i] = 1000 + i * 3; //pids are sparse but ordered
+            adtInitiateHashNode(&hash_nodes[i], keys[i], &keys[i]);
+            adtAddHashNode(&table, &hash_nodes[i]);
+            adtInitiateLinkedNode(&list_nodes[i], &keys[i]);
+            adtAddLinkedNode(&list, &list_nodes[i], 0);
+        }
+
+        srand(1); //same lookups every run
+        samples hash, linked;
+        samples_init(&hash);
+        samples_init(&linked);
+        int found = 0;
+        for(sample = 0; sample < BENCH_LOOKUP_SAMPLES; sample++) {
+            double start = now_ns();
+            for(i = 0; i < BENCH_LOOKUPS; i++) found += adtFindHashNode(&table, keys[rand() % num]) != NULL;
+            samples_add(&hash, (now_ns() - start) / BENCH_LOOKUPS);
+
+            if(num > 4096 && sample >= 5) continue; //the list is too slow for all samples
+            start = now_ns();
+            for(i = 0; i < BENCH_LOOKUPS; i++) found += adtFindLinkedValue(&list, &keys[rand() % num], compare_keys) >= 0;
+            samples_add(&linked, (now_ns() - start) / BENCH_LOOKUPS);
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "ADThashtable, %d jobs", num);
+        report(name, &hash);
+        snprintf(name, sizeof(name), "ADTlinkedlist, %d jobs", num);
+        report(name, &linked);
+        if(found != BENCH_LOOKUP_SAMPLES * BENCH_LOOKUPS + linked.num * BENCH_LOOKUPS) {
+            printf("  WARNING: lookups missed\n");
+        }
+
+        while(table.num) adtPopHashNode(&table, table.head->key);
+        adtFreeHashTable(&table);
+        xfree(list_nodes);
+        xfree(hash_nodes);
+        xfree(keys);
+    }
+}
+
+/* get_tokens throughput on typical command lines */
+static void bench_tokens(void) {
+    char * lines[] = {
+        "bglist",
+        "bg sleep 100",
+        "pstat 1200 1201 1202 1203",
+        "bg ./worker --threads 4 --input /data/input-file-0001.bin --output /tmp/out",
+        "bg sh -c \"echo 'quoted args'\" 'a b' c\\ d",
+    };
+    int num_lines = sizeof(lines) / sizeof(lines[0]);
+    int i;
+
+    table_header("get_tokens, per call");
+    int l;
+    for(l = 0; l < num_lines; l++) {
+        samples s;
+        samples_init(&s);
+        for(i = 0; i < BENCH_TOKEN_CALLS / 100; i++) {
+            int j;
+            double start = now_ns();
+            for(j = 0; j < 100; j++) free_tokens(get_tokens(lines[l]));
+            samples_add(&s, (now_ns() - start) / 100);
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "%d byte line", (int) strlen(lines[l]));
+        report(name, &s);
+    }
+}
+
+/* The /proc reading pstat used before procstat: fread into a growing
+ * buffer, sscanf over stat and a regex over status with a malloc per match.
+ * Returns -1 on failure. 0 otherwise */
+static int legacy_read(pid_t pid, regex_t * expr, procstat * stats) {
+    int buffer_size = 2000;
+    char * buffer = xmalloc(sizeof(char)*buffer_size);
+    int ret = -1;
+
+    snprintf(buffer, buffer_size,"/proc/%d/stat", pid);
+    FILE * fp_stat = fopen(buffer,"r");
+    if( !fp_stat ) goto end;
+    int buffer_end = fread(buffer,sizeof(char),buffer_size -1, fp_stat);
+    buffer[buffer_end] = 0;
+    fclose(fp_stat);
+
+    double utime = 0;
+    double stime = 0;
+    if( sscanf(buffer,"%*d %*s %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lf %lf %*d %*d %*d %*d %*d %*d %*d %*u %ld",
+               &stats->state,&utime,&stime,&stats->rss) != 4 ) goto end;
+    stats->utime = utime;
+    stats->stime = stime;
+
+    snprintf(buffer, buffer_size,"/proc/%d/status", pid);
+    FILE * fp_status = fopen(buffer,"r");
+    if( !fp_status ) goto end;
+    do {
+        buffer_end = fread(buffer,sizeof(char),buffer_size -1, fp_status);
+        if( buffer_end == buffer_size -1) {
+            buffer_size *= 2;
+            buffer = xrealloc(buffer, buffer_size);
+        }
+    } while( buffer_end == buffer_size -1 );
+    buffer[buffer_end] = 0;
+    fclose(fp_status);
+
+    regmatch_t matches[3];
+    if( regexec(expr, buffer, 3, matches,0) ) goto end;
+
+    int group;
+    for(group = 1; group <= 2; group++) {
+        int num_chars = matches[group].rm_eo - matches[group].rm_so;
+        char * match = xmalloc(sizeof(char) * (num_chars + 1));
+        memcpy(match, buffer + matches[group].rm_so, num_chars);
+        match[num_chars] = 0;
+        long value = strtol(match, NULL, 10);
+        xfree(match);
+        if(group == 1) stats->voluntary_ctxt_switches = value;
+        else stats->nonvoluntary_ctxt_switches = value;
+    }
+    ret = 0;
+
+end:
+    xfree(buffer);
+    return ret;
+}
+
+/* Per pid cost of reading stat and status, legacy path against procstat */
+static void bench_procstat(pid_t * pids, int num) {
+    char * pattern = "voluntary_ctxt_switches:[[:space:]{1,}]([[:digit:]]{1,})[[:space:]{1,}]nonvoluntary_ctxt_switches:[[:space:]{1,}]([[:digit:]]{1,})";
+    procstat stats;
+    char buffer[PROCSTAT_BUFFER_SIZE];
+    int round, i, failures = 0;
+
+    double start = now_ns();
+    for(round = 0; round < BENCH_ROUNDS; round++) {
+        regex_t expr; //pstat compiled it on every call
+        regcomp(&expr, pattern, REG_EXTENDED);
+        for(i = 0; i < num; i++) failures += legacy_read(pids[i], &expr, &stats) < 0;
+        regfree(&expr);
+    }
+    double legacy = (now_ns() - start) / (BENCH_ROUNDS * num);
+
+    start = now_ns();
+    for(round = 0; round < BENCH_ROUNDS; round++) {
+        for(i = 0; i < num; i++) failures += procstat_read(pids[i], &stats, buffer, sizeof(buffer)) < 0;
+    }
+    double current = (now_ns() - start) / (BENCH_ROUNDS * num);
+
+    char path[64]; //parse cost alone, on a stat file read once
+    snprintf(path, sizeof(path), "/proc/%d/stat", pids[0]);
+    FILE * fp = fopen(path, "r");
+    int len = fp ? fread(buffer, 1, sizeof(buffer), fp) : 0;
+    if(fp) fclose(fp);
+
+    start = now_ns();
+    for(round = 0; round < BENCH_ROUNDS * num; round++) procstat_parse_stat(buffer, len, &stats);
+    double parse = (now_ns() - start) / (BENCH_ROUNDS * num);
+
+    printf("pstat /proc read per pid (%d pids x %d rounds)\n", num, BENCH_ROUNDS);
+    printf("  legacy fread+sscanf+regex  %10.0f ns\n", legacy);
+    printf("  procstat                   %10.0f ns  (%.2fx)\n", current, legacy / current);
+    printf("  procstat stat parse only   %10.0f ns\n", parse);
+    if(failures) printf("  WARNING: %d reads failed\n", failures);
+}
+
+/* Whole table read with procstat_read_many at several thread counts */
+static void bench_procstat_parallel(pid_t * pids, int num) {
+    procstat * stats = xmalloc(sizeof(procstat) * num);
+    int * ok = xmalloc(sizeof(int) * num);
+    int default_threads = procstat_get_threads();
+    int counts[] = {1, 2, 4, 8};
+    double serial = 0;
+    int c, round;
+
+    printf("pstat over a %d job table (%d rounds, %ld cpus online)\n", num, BENCH_TABLE_ROUNDS,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    for(c = 0; c < (int) (sizeof(counts) / sizeof(counts[0])); c++) {
+        procstat_set_threads(counts[c]);
+        int read = 0;
+        double start = now_ns();
+        for(round = 0; round < BENCH_TABLE_ROUNDS; round++) read += procstat_read_many(pids, stats, ok, num);
+        double elapsed = (now_ns() - start) / BENCH_TABLE_ROUNDS / 1e6;
+        if(counts[c] == 1) serial = elapsed;
+        printf("  %d thread(s)  %8.2f ms per table  (%.2fx)%s\n", counts[c], elapsed, serial / elapsed,
+               read == num * BENCH_TABLE_ROUNDS ? "" : "  WARNING: reads failed");
+    }
+
+    procstat_set_threads(default_threads);
+    xfree(ok);
+    xfree(stats);
+}
+
+/* Forks num idle children to read stats of */
+static pid_t * start_children(int num) {
+    pid_t * pids = xmalloc(sizeof(pid_t) * num);
+    int i;
+    for(i = 0; i < num; i++) {
+        pids[i] = fork();
+        if(pids[i] == 0) {
+            pause();
+            _exit(0);
+        }
+        if(pids[i] < 0) {
+            perror("Aborting. Fork failed");
+            exit(1);
+        }
+    }
+    return pids;
+}
+
+/* Kills and reaps children from start_children */
+static void stop_children(pid_t * pids, int num) {
+    int i;
+    for(i = 0; i < num; i++) kill(pids[i], SIGKILL);
+    for(i = 0; i < num; i++) waitpid(pids[i], NULL, 0);
+    xfree(pids);
+}
+
+int main() {
+    printf("pman benchmarks, %ld cpus online, -O0 unless CFLAGS say otherwise\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+    jobtable jobs;
+    adtInitiateHashTable(&jobs.active);
+    adtInitiateHashTable(&jobs.exited);
+
+    bench_spawn(&jobs);
+    bench_signal_stats(&jobs);
+    bench_lookup();
+    bench_tokens();
+
+    printf("\n");
+    pid_t * pids = start_children(BENCH_CHILDREN);
+    bench_procstat(pids, BENCH_CHILDREN);
+    stop_children(pids, BENCH_CHILDREN);
+
+    int table_jobs = BENCH_TABLE_JOBS;
+    char * env = getenv("PMAN_BENCH_JOBS");
+    if(env && atoi(env) > 0) table_jobs = atoi(env);
+    pids = start_children(table_jobs);
+    bench_procstat_parallel(pids, table_jobs);
+    stop_children(pids, table_jobs);
+
+    adtFreeHashTable(&jobs.active);
+    adtFreeHashTable(&jobs.exited);
+    return 0;
+}
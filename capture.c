@@ -0,0 +1,154 @@
+/* Output capture implementation code */
+
+#define MEM_TAG MEM_CAPTURE
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "capture.h"
+#include "utils.h"
+
+#define CAPTURE_READS 4 //reads per event, keeps one chatty job from starving the loop
+
+static evloop * capture_loop = NULL;
+
+/* Drain captured output from loop. Captures can not be opened before */
+void capture_init(evloop * loop) {
+    capture_loop = loop;
+}
+
+/* Event loop callback for a capture pipe */
+static void on_output(int fd, unsigned int events, void * data) {
+    (void) fd; (void) events;
+    capture_drain((capture *) data);
+}
+
+/* Summary: Creates a capture and its pipe
+ * Description: Only pman's end of the pipe is nonblocking, the child
+ * writes to a blocking pipe like a terminal. The ring is allocated on
+ * the first output, jobs that print nothing only cost the struct
+ * Takes:
+ *        write_fd: set to the end for the child, close on exec
+ * Returns: the capture, NULL on failure with errno set */
+capture * capture_open(int * write_fd) {
+    if(!capture_loop) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    int pipes[2];
+    if(pipe2(pipes, O_CLOEXEC) < 0) return NULL; //dup2 copies in the child are not close on exec
+    capture * cap = xmalloc(sizeof(capture));
+    cap->fd = pipes[0];
+    cap->ring = NULL;
+    cap->total = 0;
+    if(fcntl(pipes[0], F_SETFL, O_NONBLOCK) < 0
+       || evloop_add(capture_loop, pipes[0], EPOLLIN, on_output, cap) < 0) {
+        int err = errno;
+        close(pipes[0]);
+        close(pipes[1]);
+        xfree(cap);
+        errno = err;
+        return NULL;
+    }
+    *write_fd = pipes[1];
+    return cap;
+}
+
+/* Reads straight into the free part of the ring, two iovecs when it wraps
+ * Returns: bytes read, 0 at the end of output, -1 on failure */
+static ssize_t read_ring(capture * cap) {
+    if(!cap->ring) cap->ring = xmalloc(CAPTURE_RING_SIZE);
+    size_t head = cap->total % CAPTURE_RING_SIZE;
+    struct iovec iov[2];
+    iov[0].iov_base = cap->ring + head;
+    iov[0].iov_len = CAPTURE_RING_SIZE - head;
+    iov[1].iov_base = cap->ring;
+    iov[1].iov_len = head;
+
+    ssize_t ret;
+    do {
+        ret = readv(cap->fd, iov, head ? 2 : 1);
+    } while(ret < 0 && errno == EINTR);
+    if(ret > 0) cap->total += ret;
+    return ret;
+}
+
+/* Reads whatever output is waiting in the pipe without blocking
+ * Closes the pipe once every writer closed it */
+void capture_drain(capture * cap) {
+    if(cap->fd < 0) return;
+
+    int i;
+    for(i = 0; i < CAPTURE_READS; i++) {
+        ssize_t ret = read_ring(cap);
+        if(ret > 0) continue;
+        if(ret < 0 && errno == EAGAIN) break;
+
+        if(ret < 0) perror("Warning. Reading captured output failed");
+        evloop_remove(capture_loop, cap->fd);
+        close(cap->fd);
+        cap->fd = -1;
+        if(cap->total == 0) { //never printed anything
+            xfree(cap->ring);
+            cap->ring = NULL;
+        }
+        break;
+    }
+}
+
+/* Summary: Copies the last lines of output
+ * Description: A line cut by the ring wrapping is left out. Output
+ * that does not end with a newline counts its last part as a line
+ * Takes:
+ *        cap: capture to copy from
+ *        lines: number of lines, 0 for all that is kept
+ *        len: set to the length of the copy
+ * Returns: the copy, to free with xfree */
+char * capture_tail(capture * cap, int lines, int * len) {
+    size_t kept = cap->total < CAPTURE_RING_SIZE ? cap->total : CAPTURE_RING_SIZE;
+    char * copy = xmalloc(kept + 1);
+    if(kept) {
+        size_t start = (cap->total - kept) % CAPTURE_RING_SIZE;
+        size_t first = CAPTURE_RING_SIZE - start < kept ? CAPTURE_RING_SIZE - start : kept;
+        memcpy(copy, cap->ring + start, first);
+        memcpy(copy + first, cap->ring, kept - first);
+    }
+
+    size_t pos = kept;
+    if(pos && copy[pos - 1] == '\n') pos--; //newline of the last line
+    int found = 0;
+    while(pos > 0) {
+        if(copy[pos - 1] == '\n' && ++found == lines) break;
+        pos--;
+    }
+    if(pos == 0 && cap->total > kept) { //skip the cut line
+        char * newline = memchr(copy, '\n', kept);
+        if(newline) pos = newline - copy + 1;
+    }
+
+    memmove(copy, copy + pos, kept - pos);
+    *len = kept - pos;
+    return copy;
+}
+
+/* Bytes that did not fit in the ring */
+unsigned long capture_dropped(capture * cap) {
+    return cap->total > CAPTURE_RING_SIZE ? cap->total - CAPTURE_RING_SIZE : 0;
+}
+
+/* Stops draining, closes the pipe and frees the capture */
+void capture_free(capture * cap) {
+    if(cap->fd >= 0) {
+        evloop_remove(capture_loop, cap->fd);
+        close(cap->fd);
+    }
+    if(cap->ring) xfree(cap->ring);
+    xfree(cap);
+}
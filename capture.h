@@ -0,0 +1,40 @@
+/* Output capture header. A job started with --capture writes its stdout
+ * and stderr into one pipe, pman drains it from the event loop into a
+ * fixed size ring, so memory per job is bounded however much it prints */
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include "evloop.h"
+
+#define CAPTURE_RING_SIZE 16384 //bytes kept per job, the oldest output is dropped first
+
+/* Struct for the captured output of a job */
+typedef struct capture {
+    int fd; //read end of the pipe, -1 once every writer closed it
+    char * ring; //allocated on the first output
+    unsigned long total; //bytes received, the ring holds the last CAPTURE_RING_SIZE of them
+} capture;
+
+/* Drain captured output from loop. Captures can not be opened before */
+void capture_init(evloop * loop);
+
+/* Creates a capture and its pipe. The child gets write_fd as stdout and
+ * stderr, the caller closes write_fd once the child started
+ * Returns: the capture, NULL on failure with errno set */
+capture * capture_open(int * write_fd);
+
+/* Reads whatever output is waiting in the pipe without blocking */
+void capture_drain(capture * cap);
+
+/* Copies the last lines of output, a cut first line is left out
+ * Returns: the copy, to free with xfree, len set to its length */
+char * capture_tail(capture * cap, int lines, int * len);
+
+/* Bytes that did not fit in the ring */
+unsigned long capture_dropped(capture * cap);
+
+/* Stops draining, closes the pipe and frees the capture */
+void capture_free(capture * cap);
+
+#endif
@@ -0,0 +1,1383 @@
+/* Commands of pman that manage background jobs */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <fnmatch.h>
+
+#include "capture.h"
+#include "commands.h"
+#include "events.h"
+#include "metrics.h"
+#include "output.h"
+#include "perf.h"
+#include "procstat.h"
+#include "proctree.h"
+#include "queue.h"
+#include "spawn.h"
+#include "utils.h"
+
+
+/* Specialized memory freeing funtion ADThash node inside a subprogram*/
+void free_node(ADThashnode * node) {
+    job_free((subprogram *) node->val);
+}
+
+/* Adds a started child to the active jobs, named after its program
+ * group may be NULL, the child must already have joined it
+ * Returns: the new job */
+subprogram * add_job(jobtable * jobs, pid_t child, char * program, jobgroup * group) {
+    unsigned long long start = metrics_now();
+    subprogram * job = job_alloc(child, program);
+    job_open_pidfd(job);
+    job->group = group;
+    adtAddHashNode(&jobs->active, &job->node);
+    metrics_phase_record(PHASE_INSERT, start);
+    return job;
+}
+
+
+/* Summary: Parses the leading --options of bg and bgmany
+ * Takes:
+ *        args: arguements, options first
+ *        options: set to the parsed options
+ * Returns: number of arguements used by options, -1 on an invalid option */
+int parse_job_options(char * * args, job_options * options) {
+    options->group = NULL;
+    options->capture = 0;
+    options->perf = 0;
+    placement_init(&options->place);
+    watchdog_limits_init(&options->limits);
+
+    int used = 0;
+    while(args[used] && strncmp(args[used], "--", 2) == 0) {
+        char * option = args[used];
+        if(strcmp(option, "--group") == 0) {
+            if(!args[used + 1] || !(options->group = group_find(args[used + 1], 1))) {
+                out_printf("Invalid group name, use letters, digits, '_', '-' and '.'\n");
+                return -1;
+            }
+            used += 2;
+        } else if(strcmp(option, "--capture") == 0) {
+            options->capture = 1;
+            used++;
+        } else if(strcmp(option, "--perf") == 0) {
+            options->perf = 1;
+            used++;
+        } else {
+            int placed = placement_parse_option(args + used, &options->place);
+            if(!placed) placed = watchdog_parse_option(args + used, &options->limits);
+            if(placed < 0) return -1;
+            if(!placed) {
+                out_printf("Unknown option %s\n", option);
+                return -1;
+            }
+            used += placed;
+        }
+    }
+    return used;
+}
+
+/* Spawn options for a job started with options, spread_cpu and
+ * spread_node set to what it claimed from placement_apply */
+static void job_spawn_options(const job_options * options, spawn_options * spawn, int * spread_cpu,
+                              int * spread_node) {
+    spawn_init_options(spawn);
+    *spread_cpu = -1;
+    *spread_node = -1;
+    if(!options) return;
+    if(options->group) {
+        spawn->pgid = options->group->pgid; //0 makes the first job the leader
+        spawn->procs_fd = options->group->procs_fd;
+    }
+    placement_apply(&options->place, spawn, spread_cpu, spread_node);
+}
+
+
+/* Opens a capture when options ask for one, its pipe becomes the output of spawn
+ * cap is set to NULL when none is asked for
+ * Returns: -1 on failure with err set, 0 otherwise */
+static int open_capture(const job_options * options, spawn_options * spawn, capture * * cap, int * err) {
+    *cap = NULL;
+    if(!options || !options->capture) return 0;
+    *cap = capture_open(&spawn->out_fd);
+    if(!*cap) {
+        *err = errno;
+        return -1;
+    }
+    return 0;
+}
+
+/* Closes pman's copy of the child's end of a capture pipe, and frees
+ * the capture when the child did not start */
+static void close_capture(spawn_options * spawn, capture * cap, pid_t child) {
+    if(spawn->out_fd >= 0) close(spawn->out_fd);
+    spawn->out_fd = -1;
+    if(cap && child < 0) capture_free(cap);
+}
+
+/* Summary: Starts the child of a job
+ * Description: Like spawn_start, with --perf the child is held before
+ * exec until its counters are attached, so they count from the exec.
+ * A job whose counters can not be opened runs without them
+ * Takes:
+ *        args: arguements, first is the program
+ *        options: options of the job, may be NULL
+ *        spawn: spawn options from job_spawn_options
+ *        confirm_fd: set as by spawn_start
+ *        perf: set to the counters, NULL without them
+ *        err: set to the errno of the failed call on failure, or of
+ *             perf_event_open when the child runs without counters
+ * Returns: the pid of the child, -1 on failure */
+static pid_t spawn_job(char * * args, const job_options * options, spawn_options * spawn, int * confirm_fd,
+                       perf_group * * perf, int * err) {
+    *perf = NULL;
+    if(!options || !options->perf) return spawn_start(args, spawn, confirm_fd, err);
+
+    int release_fd;
+    pid_t child = spawn_start_held(args, spawn, confirm_fd, &release_fd, err);
+    if(child < 0) return -1;
+    *perf = perf_attach(child);
+    if(!*perf) *err = errno; //reported by the caller if it starts
+    close(release_fd); //the child execs now
+    return child;
+}
+
+/* Summary: Starts a background job without printing
+ * Takes:
+ *        jobs: table of all programs
+ *        args: arguements, first is the program
+ *        options: options of the job, may be NULL
+ *        err: set to the errno of the failed call on failure, or why
+ *             perf counters asked for could not be attached
+ * Returns: the new job, NULL on failure */
+subprogram * start_job(jobtable * jobs, char * * args, const job_options * options, int * err) {
+    spawn_options spawn;
+    int spread_cpu, spread_node;
+    job_spawn_options(options, &spawn, &spread_cpu, &spread_node);
+    *err = 0;
+    capture * cap;
+    pid_t child = -1;
+    perf_group * perf = NULL;
+    if(open_capture(options, &spawn, &cap, err) == 0) {
+        int confirm_fd;
+        child = spawn_job(args, options, &spawn, &confirm_fd, &perf, err);
+        if(child >= 0 && confirm_fd >= 0 && spawn_confirm(child, confirm_fd, err) < 0) child = -1;
+        close_capture(&spawn, cap, child);
+    }
+    if(child < 0) {
+        if(perf) perf_close(perf);
+        placement_release(spread_cpu, spread_node);
+        return NULL;
+    }
+
+    jobgroup * group = options ? options->group : NULL;
+    if(group) group_join(group, child);
+    subprogram * job = add_job(jobs, child, args[0], group);
+    job->capture = cap;
+    job->perf = perf;
+    job->spread_cpu = spread_cpu;
+    job->spread_node = spread_node;
+    watchdog_add(job, options ? &options->limits : NULL);
+    return job;
+}
+
+/*
+ * Summary: Attempts to create a new process
+ * Description: Creates a process with the selected spawn backend, all
+ * backends detect failures in exec. Prints an error message on failure.
+ * Takes:
+ *       jobs: table of all subprograms
+ *       args: options, then array of arguements, first assumed to be program name
+ * Returns: -1 on failure, 0 otherwise
+ */
+int create_process(jobtable * jobs, char * args[]) {
+
+    job_options options;
+    int used = parse_job_options(args, &options);
+    if(used < 0) return -1;
+    args += used;
+    if(!args[0]) {
+        out_printf("Program not provided\nusage: bg [options] program [arg1 arg2...]\n");
+        return -1;
+    }
+
+    int err = 0;
+    subprogram * job = start_job(jobs, args, &options, &err);
+    if(!job) {
+        errno = err;
+        out_perror("Aborting. Starting the program failed (is the program valid?)");
+        return -1;
+    }
+
+    pid_t child = job->pid;
+    if(out_get_format() == OUT_HUMAN) {
+        out_printf("%s(pid=%d) started\n",args[0],child);
+    } else {
+        out_record("started");
+        out_field_int("pid", child);
+        out_field_str("name", args[0]);
+        out_end_record();
+    }
+    if(options.perf && !job->perf) {
+        out_printf("Warning. No perf counters for %s(pid=%d): %s\n", args[0], child, strerror(err));
+    }
+    return 0;
+}
+
+
+#define BULK_WINDOW 256 //exec confirmations in flight, bounds open pipes
+
+/* Results of a bulk start, printed as one summary */
+typedef struct bulk_summary {
+    pid_t * pids; //started pids
+    int pids_size;
+    int started;
+    int failed;
+    char * failures; //failed programs and reasons, in one line
+    int failures_size;
+} bulk_summary;
+
+/* Records a started pid in a bulk summary, a record at once in json and tsv */
+static void add_started(bulk_summary * summary, pid_t child, char * program) {
+    if(out_get_format() != OUT_HUMAN) {
+        out_record("started");
+        out_field_int("pid", child);
+        out_field_str("name", program);
+        out_end_record();
+    }
+    if(summary->started == summary->pids_size) {
+        summary->pids_size *= 2;
+        summary->pids = xrealloc(summary->pids, sizeof(pid_t) * summary->pids_size);
+    }
+    summary->pids[summary->started++] = child;
+}
+
+/* Records a program that failed to start in a bulk summary, a record at once in json and tsv */
+static void add_failure(bulk_summary * summary, char * program, int err) {
+    summary->failed++;
+    if(out_get_format() != OUT_HUMAN) {
+        out_record("failed");
+        out_field_str("name", program);
+        out_field_str("error", strerror(err));
+        out_end_record();
+        return;
+    }
+    int len = strlen(summary->failures);
+    int need = len + strlen(program) + strlen(strerror(err)) + 4; //space, parens and null
+    if(need > summary->failures_size) {
+        while(need > summary->failures_size) summary->failures_size *= 2;
+        summary->failures = xrealloc(summary->failures, summary->failures_size);
+    }
+    sprintf(summary->failures + len, " %s(%s)", program, strerror(err));
+}
+
+/*
+ * Summary: Attempts to create many processes at once
+ * Description: Issues the spawns of a window of jobs first, then collects
+ * all of their exec confirmations with one poll. Prints a single summary
+ * with the started pids and failed programs.
+ * Takes:
+ *       jobs: table of all subprograms
+ *       specs: null terminated array of arguement arrays, one per job
+ *       options: options of every job, may be NULL
+ * Returns: -1 if any job failed to start, 0 otherwise
+ */
+int create_processes(jobtable * jobs, char * * * specs, const job_options * options) {
+    jobgroup * group = options ? options->group : NULL;
+    spawn_options spawn;
+    pid_t pending_pids[BULK_WINDOW];
+    char * * pending_args[BULK_WINDOW];
+    capture * pending_caps[BULK_WINDOW];
+    perf_group * pending_perfs[BULK_WINDOW];
+    int pending_cpus[BULK_WINDOW]; //spread claims
+    int pending_nodes[BULK_WINDOW];
+    struct pollfd pending_fds[BULK_WINDOW];
+
+    bulk_summary summary;
+    summary.pids_size = 16;
+    summary.pids = xmalloc(sizeof(pid_t) * summary.pids_size);
+    summary.started = 0;
+    summary.failed = 0;
+    summary.failures_size = 256;
+    summary.failures = xmalloc(sizeof(char) * summary.failures_size);
+    summary.failures[0] = 0;
+
+    while(*specs) {
+        int num = 0;
+        for(; *specs && num < BULK_WINDOW; specs++) { //issue every spawn in the window
+
+            char * * args = *specs;
+            int confirm_fd = -1;
+            int err = 0;
+            int spread_cpu, spread_node;
+            job_spawn_options(options, &spawn, &spread_cpu, &spread_node); //the group leader is known after the first spawn
+            capture * cap;
+            if(open_capture(options, &spawn, &cap, &err) < 0) {
+                add_failure(&summary, args[0], err);
+                placement_release(spread_cpu, spread_node);
+                continue;
+            }
+            perf_group * perf;
+            pid_t child = spawn_job(args, options, &spawn, &confirm_fd, &perf, &err);
+            close_capture(&spawn, cap, child);
+            if(child >= 0 && group) group_join(group, child); //joined before exec, left if it fails
+
+            if(child >= 0 && confirm_fd >= 0) { //wait for exec with the rest of the window
+                pending_pids[num] = child;
+                pending_args[num] = args;
+                pending_caps[num] = cap;
+                pending_perfs[num] = perf;
+                pending_cpus[num] = spread_cpu;
+                pending_nodes[num] = spread_node;
+                pending_fds[num].fd = confirm_fd;
+                pending_fds[num].events = POLLIN;
+                num++;
+                continue;
+            }
+
+            if(child < 0) {
+                add_failure(&summary, args[0], err);
+                placement_release(spread_cpu, spread_node);
+            } else {
+                add_started(&summary, child, args[0]);
+                subprogram * job = add_job(jobs, child, args[0], group);
+                job->capture = cap;
+                job->perf = perf;
+                job->spread_cpu = spread_cpu;
+                job->spread_node = spread_node;
+                watchdog_add(job, options ? &options->limits : NULL);
+            }
+        }
+
+        int left = num;
+        while(left) { //collect all confirmations of the window
+            if(poll(pending_fds, num, -1) < 0) {
+                if(errno == EINTR) continue;
+                out_perror("Warning. Polling exec confirmations failed, waiting on each");
+                int i;
+                for(i = 0; i < num; i++) {
+                    if(pending_fds[i].fd >= 0) pending_fds[i].revents = POLLIN;
+                }
+            }
+
+            int i;
+            for(i = 0; i < num; i++) {
+                if(pending_fds[i].fd < 0 || !pending_fds[i].revents) continue;
+
+                int err = 0;
+                if(spawn_confirm(pending_pids[i], pending_fds[i].fd, &err) < 0) {
+                    add_failure(&summary, pending_args[i][0], err);
+                    if(group) group_leave(group);
+                    if(pending_caps[i]) capture_free(pending_caps[i]);
+                    if(pending_perfs[i]) perf_close(pending_perfs[i]);
+                    placement_release(pending_cpus[i], pending_nodes[i]);
+                } else {
+                    add_started(&summary, pending_pids[i], pending_args[i][0]);
+                    subprogram * job = add_job(jobs, pending_pids[i], pending_args[i][0], group);
+                    job->capture = pending_caps[i];
+                    job->perf = pending_perfs[i];
+                    job->spread_cpu = pending_cpus[i];
+                    job->spread_node = pending_nodes[i];
+                    watchdog_add(job, options ? &options->limits : NULL);
+                }
+                pending_fds[i].fd = -1; //poll ignores negative fds
+                left--;
+            }
+        }
+    }
+
+    if(out_get_format() != OUT_HUMAN) {
+        out_record("bulk");
+        out_field_int("started", summary.started);
+        out_field_int("failed", summary.failed);
+        out_end_record();
+    } else {
+        out_printf("Bulk start: %d started, %d failed\n", summary.started, summary.failed);
+    }
+    if(summary.started && out_get_format() == OUT_HUMAN) {
+        out_printf("Started pids:");
+        int i;
+        for(i = 0; i < summary.started; i++) out_printf(" %d", summary.pids[i]);
+        out_printf("\n");
+    }
+    if(summary.failed && out_get_format() == OUT_HUMAN) out_printf("Failed programs:%s\n", summary.failures);
+
+    xfree(summary.failures);
+    xfree(summary.pids);
+    return summary.failed ? -1 : 0;
+}
+
+
+/* Summary: Runs the bgmany command
+ * Description: Builds one arguement array per job, either count copies of
+ * a program or one program per line of a file, and starts them together
+ * Takes:
+ *       jobs: table of all subprograms
+ *       args: arguements after bgmany
+ * Returns: -1 on failure, 0 otherwise
+ */
+int create_many(jobtable * jobs, char * * args) {
+    job_options options;
+    int used = parse_job_options(args, &options);
+    if(used < 0) return -1;
+    args += used;
+    if(!args[0]) {
+        out_printf("Nothing to start\nusage: bgmany [options] count program [arg1 arg2...] | bgmany -f file\n");
+        return -1;
+    }
+
+    if(strcmp(args[0], "-f") == 0) {
+        if(!args[1] || args[2]) {
+            out_printf("One file expected\nusage: bgmany [options] -f file\n");
+            return -1;
+        }
+
+        FILE * fp = fopen(args[1], "r");
+        if(!fp) {
+            out_perror("Aborting. Opening the arguement file failed");
+            return -1;
+        }
+
+        int specs_size = 16;
+        int num = 0;
+        char * * * specs = xmalloc_tagged(sizeof(char * *) * specs_size, MEM_TOKENS);
+        char * line = NULL;
+        size_t line_size = 0;
+        while(getline(&line, &line_size, fp) > 0) {
+            char * * tokens = get_tokens(line);
+            if(!tokens) continue; //blank line
+            if(tokens[0][0] == '#') { //comment line
+                free_tokens(tokens);
+                continue;
+            }
+            if(num == specs_size - 1) { //room for null
+                specs_size *= 2;
+                specs = xrealloc(specs, sizeof(char * *) * specs_size);
+            }
+            specs[num++] = tokens;
+        }
+        specs[num] = NULL;
+        free(line); //allocated by getline
+        fclose(fp);
+
+        int ret = -1;
+        if(num) ret = create_processes(jobs, specs, &options);
+        else out_printf("No programs found in %s\n", args[1]);
+
+        int i;
+        for(i = 0; i < num; i++) free_tokens(specs[i]);
+        xfree(specs);
+        return ret;
+    }
+
+    int count = extract_pid(args[0]); //same rules as a pid, a positive int
+    if(count <= 0 || !args[1]) {
+        out_printf("Invalid count or program\nusage: bgmany [options] count program [arg1 arg2...]\n");
+        return -1;
+    }
+
+    char * * * specs = xmalloc_tagged(sizeof(char * *) * (count + 1), MEM_TOKENS);
+    int i;
+    for(i = 0; i < count; i++) specs[i] = args + 1;
+    specs[count] = NULL;
+    int ret = create_processes(jobs, specs, &options);
+    xfree(specs);
+    return ret;
+}
+
+
+/* Summary: Reaps all children that have exited
+ * Description: Moves every exited job from the active table to the exited
+ * table, where it waits until bglist reports it. Cheap to call often, costs
+ * one waitpid when nothing has exited. Queued jobs are started in the
+ * slots of reaped queue jobs.
+ * Takes:
+ *        jobs: table of all programs
+ */
+void reap_children(jobtable * jobs) {
+    unsigned long long start = metrics_now();
+    int reaped = 0;
+    while(1) {
+        int status = 0;
+        pid_t pid = waitpid(-1,&status,WNOHANG); // 0 on no exited child
+        if(pid < 0) {
+            if(errno != ECHILD) perror("Warning. A waitpid call failed");
+            break;
+        }
+        if(pid == 0) break;
+
+        ADThashnode * node = adtPopHashNode(&jobs->active,pid);
+        if(!node) {
+            fprintf(stderr,"WARNING: A waitpid call returned an unknown pid\n");
+            continue;
+        }
+        subprogram * program = (subprogram *) node->val;
+        program->status = status;
+        job_close_pidfd(program); //reaped, the pid may already be reused
+        if(program->group) group_leave(program->group);
+        placement_release(program->spread_cpu, program->spread_node);
+        program->spread_cpu = program->spread_node = -1;
+        queue_reaped(program);
+
+        ADThashnode * stale = adtPopHashNode(&jobs->exited,pid); //pid was reused before bglist ran
+        if(stale) free_node(stale);
+        adtAddHashNode(&jobs->exited,node);
+        reaped++;
+    }
+    if(reaped) metrics_phase_record(PHASE_REAP, start);
+
+    queue_dispatch(jobs); //reaped queue jobs free their slots at once
+}
+
+
+/* Kinds of job selectors */
+enum selector_type {SELECT_ALL, SELECT_RANGE, SELECT_NAME, SELECT_STATE, SELECT_GROUP};
+
+/* Struct for one parsed selector token */
+typedef struct selector {
+    enum selector_type type;
+    pid_t low, high; //inclusive pid range
+    const char * value; //name pattern or state letters
+    jobgroup * group; //NULL if no group has the name
+    const char * token; //as typed, for messages
+} selector;
+
+/* Parses a selector token, returns -1 if it is not one */
+static int parse_selector(char * token, selector * sel) {
+    sel->token = token;
+    if(strcmp(token, "all") == 0) {
+        sel->type = SELECT_ALL;
+        return 0;
+    }
+    if(strncmp(token, "name:", 5) == 0 && token[5]) {
+        sel->type = SELECT_NAME;
+        sel->value = token + 5;
+        return 0;
+    }
+    if(strncmp(token, "state:", 6) == 0 && token[6]) {
+        sel->type = SELECT_STATE;
+        sel->value = token + 6;
+        return 0;
+    }
+    if(token[0] == '@' && token[1]) {
+        sel->type = SELECT_GROUP;
+        sel->group = group_find(token + 1, 0);
+        return 0;
+    }
+
+    char * endptr = NULL;
+    if(*token < '0' || *token > '9') return -1;
+    long low = strtol(token, &endptr, 10);
+    if(*endptr != '-' || endptr[1] < '0' || endptr[1] > '9') return -1;
+    long high = strtol(endptr + 1, &endptr, 10);
+    if(*endptr || low > high) return -1;
+    sel->type = SELECT_RANGE;
+    sel->low = low;
+    sel->high = high;
+    return 0;
+}
+
+/* Checks if a job matches a selector, state is its /proc state */
+static int match_selector(selector * sel, subprogram * program, char state) {
+    switch(sel->type) {
+    case SELECT_ALL:
+        return 1;
+    case SELECT_RANGE:
+        return program->pid >= sel->low && program->pid <= sel->high;
+    case SELECT_NAME: {
+        const char * base = strrchr(program->name, '/'); //worker* matches ./worker1 too
+        return fnmatch(sel->value, program->name, 0) == 0
+               || (base && fnmatch(sel->value, base + 1, 0) == 0);
+    }
+    case SELECT_STATE:
+        return state && strchr(sel->value, state) != NULL;
+    case SELECT_GROUP:
+        return sel->group && program->group == sel->group;
+    }
+    return 0;
+}
+
+/* Sort jobs by pid, records sharing a pid by address */
+static int compare_jobs(const void * val1, const void * val2) {
+    const subprogram * j1 = *(subprogram * const *) val1;
+    const subprogram * j2 = *(subprogram * const *) val2;
+    if(j1->pid != j2->pid) return j1->pid - j2->pid;
+    return (j1 > j2) - (j1 < j2);
+}
+
+/*
+ * Summary: Resolves pids and selectors to a set of jobs
+ * Description: Tokens are pids, all, pid ranges (1200-1300), name
+ * patterns (name:worker*), state letters (state:T) or groups (@web). Selectors are
+ * resolved together in one pass over the active jobs, /proc is only read
+ * when a state is selected. Errors are printed per token.
+ * Takes:
+ *        jobs: table of all programs
+ *        tokens: null terminated pids and selectors
+ *        exited: also accept pids of exited jobs not yet reported
+ *        action: text for unknown pids, as in "Cannot <action> 12(PID UNKNOWN)"
+ *        selected: set to the jobs in pid order without duplicates, free with xfree
+ * Returns: number of selected jobs, -1 - number if any token failed
+ */
+static int select_jobs(jobtable * jobs, char * * tokens, int exited, const char * action,
+                       subprogram * * * selected) {
+    unsigned long long start = metrics_now();
+    int failed = 0;
+    int num_tokens = 0;
+    while(tokens[num_tokens]) num_tokens++;
+
+    selector * sels = xmalloc(sizeof(selector) * num_tokens);
+    int * matched = xmalloc(sizeof(int) * num_tokens);
+    int num_sels = 0;
+    int want_state = 0;
+
+    int size = num_tokens + 1;
+    subprogram * * picked = xmalloc(sizeof(subprogram *) * size);
+    int num = 0;
+
+    for(; *tokens; tokens++) {
+        if(parse_selector(*tokens, &sels[num_sels]) == 0) {
+            if(sels[num_sels].type == SELECT_STATE) want_state = 1;
+            matched[num_sels++] = 0;
+            continue;
+        }
+
+        pid_t pid;
+        if( (pid = extract_pid(*tokens)) == -1 ) {
+            out_printf("Invalid pid or selector, skipping %s\n", *tokens);
+            failed = 1;
+            continue;
+        }
+
+        ADThashnode * node = adtFindHashNode(&jobs->active, pid);
+        if(!node && exited) node = adtFindHashNode(&jobs->exited, pid);
+        if(!node) {
+            out_printf("Cannot %s %d(PID UNKNOWN) \n", action, pid);
+            failed = 1;
+            continue;
+        }
+        picked[num++] = (subprogram *) node->val;
+    }
+
+    if(num_sels) {
+        int total = jobs->active.num;
+        size = num + total + 1;
+        picked = xrealloc(picked, sizeof(subprogram *) * size);
+
+        char * states = NULL;
+        if(want_state) { //one parallel /proc read for every job, in list order
+            pid_t * pids = xmalloc_tagged(sizeof(pid_t) * (total + 1), MEM_STATS);
+            procstat * stats = xmalloc_tagged(sizeof(procstat) * (total + 1), MEM_STATS);
+            int * ok = xmalloc_tagged(sizeof(int) * (total + 1), MEM_STATS);
+            states = xmalloc_tagged(total + 1, MEM_STATS);
+            int i = 0;
+            ADThashnode * node;
+            for(node = jobs->active.head; node; node = node->next) pids[i++] = node->key;
+            procstat_read_many(pids, stats, ok, total);
+            for(i = 0; i < total; i++) states[i] = ok[i] ? stats[i].state : 0;
+            xfree(ok);
+            xfree(stats);
+            xfree(pids);
+        }
+
+        int i = 0;
+        ADThashnode * node;
+        for(node = jobs->active.head; node; node = node->next, i++) {
+            subprogram * program = (subprogram *) node->val;
+            int hit = 0;
+            int j;
+            for(j = 0; j < num_sels; j++) {
+                if(match_selector(&sels[j], program, states ? states[i] : 0)) {
+                    matched[j]++;
+                    hit = 1;
+                }
+            }
+            if(hit) picked[num++] = program;
+        }
+        if(states) xfree(states);
+
+        for(i = 0; i < num_sels; i++) {
+            if(matched[i]) continue;
+            out_printf("No jobs match %s\n", sels[i].token);
+            failed = 1;
+        }
+    }
+
+    qsort(picked, num, sizeof(subprogram *), compare_jobs);
+    int unique = 0;
+    int i;
+    for(i = 0; i < num; i++) {
+        if(unique && picked[unique - 1] == picked[i]) continue; //pid given twice
+        picked[unique++] = picked[i];
+    }
+
+    xfree(matched);
+    xfree(sels);
+    *selected = picked;
+    metrics_phase_record(PHASE_LOOKUP, start);
+    return failed ? -1 - unique : unique;
+}
+
+
+/* Summary: Sends a signal to a whole group
+ * Description: One killpg, or a write to cgroup.kill or cgroup.freeze
+ * when the group has a cgroup, reaches every process of the group
+ * Takes:
+ *        name: name of the group
+ *        signal: signal type to send, SIGSTOP and SIGCONT freeze and thaw
+ * Returns: -1 on failure, 0 otherwise
+ */
+static int signal_group(const char * name, int signal) {
+    jobgroup * group = group_find(name, 0);
+    if(!group) {
+        out_printf("Cannot send %s to @%s(GROUP UNKNOWN)\n", strsignal(signal), name);
+        return -1;
+    }
+
+    int ret;
+    const char * via;
+    if(signal == SIGKILL) {
+        ret = group_kill(group, &via);
+    } else if(signal == SIGSTOP || signal == SIGCONT) {
+        ret = group_freeze(group, signal == SIGSTOP, &via);
+    } else {
+        ret = group_signal(group, signal);
+        via = "killpg";
+    }
+
+    if(ret < 0) {
+        if(errno == ESRCH) {
+            out_printf("No signal sent to @%s, it has no running jobs\n", name);
+        } else {
+            out_perror("Sending signal to the group failed");
+        }
+        return -1;
+    }
+    if(out_get_format() == OUT_HUMAN) {
+        out_printf("%s sent to @%s (%d jobs, %s)\n", strsignal(signal), name, group->members, via);
+    } else {
+        out_record("group_signal");
+        out_field_str("group", name);
+        out_field_int("signal", signal);
+        out_field_str("signal_name", strsignal(signal));
+        out_field_int("jobs", group->members);
+        out_field_str("via", via);
+        out_end_record();
+    }
+    return 0;
+}
+
+/* Summary: Signals the descendants of a job
+ * Description: Parents come before their children, so stopped or killed
+ * parents can not start new ones. Descendants are checked against their
+ * start time by the collect just before, there is no pidfd for them
+ * Takes:
+ *        members: from proctree_collect, the job first
+ *        num: number of members
+ *        signal: signal type to send
+ * Returns: number of descendants signalled */
+static int signal_descendants(proctree_member * members, int num, int signal) {
+    int sent = 0;
+    int i;
+    for(i = 1; i < num; i++) {
+        if(kill(members[i].stats.pid, signal) == 0) sent++; //ESRCH when it exited since
+    }
+    return sent;
+}
+
+/* Summary: Send a signal to processes if they are still alive
+ * Description: Takes an array of pids and selectors that is null
+ * terminated and sends the signal to every selected job as one batch.
+ * Liveness of all jobs is checked with one poll of their pidfds, and
+ * signals go through the pidfds, which always refer to the job's process.
+ * Only jobs not reaped yet are signalled, their zombie keeps the pid from
+ * reuse, so the kill fallback without a pidfd is safe too.
+ * A batch of many jobs is reported with one summary line. Each @group
+ * is signalled as a whole, see signal_group. With --tree first every
+ * descendant of a selected job is signalled after it
+ * Takes:
+ *        jobs: table of all programs
+ *        processes: optional --tree, then strings of process ids or selectors
+ *        signal: signal type to send to each process
+ * Returns: -1 if any process was not signalled, 0 otherwise
+ */
+int send_signal(jobtable * jobs, char * * processes, int signal) {
+    int ret = 0;
+    int tree = 0;
+    if(processes[0] && strcmp(processes[0], "--tree") == 0) {
+        tree = 1;
+        processes++;
+    }
+    if(!processes[0]) {
+        out_printf("No pid provided\n");
+        return -1;
+    }
+
+    int num = 0;
+    while(processes[num]) num++;
+    char * * rest = xmalloc(sizeof(char *) * (num + 1)); //tokens that are not groups
+    int num_rest = 0;
+    for(; *processes; processes++) {
+        if((*processes)[0] != '@') rest[num_rest++] = *processes;
+        else if(signal_group(*processes + 1, signal) < 0) ret = -1;
+    }
+    rest[num_rest] = NULL;
+    if(!num_rest) {
+        xfree(rest);
+        return ret;
+    }
+
+    char action[64];
+    snprintf(action, sizeof(action), "send %s to", strsignal(signal));
+    subprogram * * targets;
+    num = select_jobs(jobs, rest, 1, action, &targets);
+    xfree(rest);
+    if(num < 0) {
+        num = -1 - num;
+        ret = -1;
+    }
+
+    //catch exits the event loop has not handled yet, only when a pidfd shows one
+    if(job_poll_exited(targets, num)) reap_children(jobs);
+    if(tree) proctree_scan(jobs); //once for all the trees
+
+    int sent = 0;
+    int gone = 0;
+    int descendants = 0;
+    int i;
+    for(i = 0; i < num; i++) {
+        subprogram * program = targets[i];
+
+        if( adtFindHashNode(&jobs->active,program->pid) != &program->node ) {
+            if(num > 1 || out_get_format() != OUT_HUMAN) {
+                gone++;
+            } else if(WIFSIGNALED(program->status)) {
+                out_printf("No signal sent to %s (pid=%d), it has been killed\n", program->name, program->pid);
+            } else {
+                out_printf("No signal sent to %s (pid=%d), it has exited\n", program->name, program->pid);
+            }
+            ret = -1;
+            continue;
+        }
+
+        proctree_member * members = NULL;
+        int num_members = tree ? proctree_collect(program, &members) : 0; //before a kill makes orphans
+
+        //the pidfd always refers to the job, a kill fallback is safe only because it is not reaped yet
+        if (job_signal(program,signal) == -1) {
+            out_perror("Aborting all. Sending signal failed");
+            if(members) xfree(members);
+            ret = -1;
+            break;
+        }
+        sent++;
+        if(members) {
+            descendants += signal_descendants(members, num_members, signal);
+            xfree(members);
+        }
+    }
+
+    if(out_get_format() != OUT_HUMAN) {
+        out_record("signal");
+        out_field_int("signal", signal);
+        out_field_str("signal_name", strsignal(signal));
+        out_field_int("sent", sent);
+        out_field_int("exited", gone);
+        out_field_int("not_attempted", num - sent - gone);
+        out_field_int("descendants", descendants);
+        out_end_record();
+    } else if(num == 1 && sent) {
+        out_printf("%s sent to %d",strsignal(signal), targets[0]->pid);
+        if(tree) out_printf(" and %d descendants", descendants);
+        out_printf("\n");
+    } else if(num > 1) {
+        out_printf("%s sent to %d jobs", strsignal(signal), sent);
+        if(tree) out_printf(" and %d descendants", descendants);
+        if(gone) out_printf(", %d had already exited", gone);
+        if(sent + gone < num) out_printf(", %d not attempted", num - sent - gone);
+        out_printf("\n");
+    }
+
+    xfree(targets);
+    return ret;
+}
+
+
+ /* Sort pids in increasing order */
+int compare_pids(const void * val1, const void * val2) {
+    return *(const pid_t *) val1 - *(const pid_t *) val2;
+}
+
+/* Prints the perf counters of a job after its stats, IPC and misses per
+ * thousand instructions for hardware counters. One read per job */
+static void print_perf(subprogram * program) {
+    perf_values values;
+    int read_ok = program->perf && perf_read(program->perf, &values) == 0;
+    const unsigned long long * c = values.counts;
+    double ipc = 0, cache_mpki = 0, branch_mpki = 0;
+    if(read_ok && values.hardware && c[PERF_INSTRUCTIONS]) {
+        ipc = c[PERF_CYCLES] ? (double) c[PERF_INSTRUCTIONS] / c[PERF_CYCLES] : 0;
+        cache_mpki = 1000.0 * c[PERF_CACHE_MISSES] / c[PERF_INSTRUCTIONS];
+        branch_mpki = 1000.0 * c[PERF_BRANCH_MISSES] / c[PERF_INSTRUCTIONS];
+    }
+
+    if(out_get_format() != OUT_HUMAN) {
+        int hardware = read_ok && values.hardware;
+        int software = read_ok && !values.hardware;
+        out_record("perf");
+        out_field_int("pid", program->pid);
+        out_field_str("source", !read_ok ? "none" : hardware ? "hardware" : "software");
+        out_field_int("cycles", hardware ? c[PERF_CYCLES] : 0);
+        out_field_int("instructions", hardware ? c[PERF_INSTRUCTIONS] : 0);
+        out_field_int("cache_misses", hardware ? c[PERF_CACHE_MISSES] : 0);
+        out_field_int("branch_misses", hardware ? c[PERF_BRANCH_MISSES] : 0);
+        out_field_double("ipc", ipc);
+        out_field_double("cache_mpki", cache_mpki);
+        out_field_double("branch_mpki", branch_mpki);
+        out_field_int("task_clock_ns", software ? c[PERF_TASK_CLOCK] : 0);
+        out_field_int("page_faults", software ? c[PERF_PAGE_FAULTS] : 0);
+        out_field_int("context_switches", software ? c[PERF_CONTEXT_SWITCHES] : 0);
+        out_field_int("cpu_migrations", software ? c[PERF_CPU_MIGRATIONS] : 0);
+        out_field_double("running", read_ok ? values.running : 0);
+        out_end_record();
+        return;
+    }
+
+    if(!program->perf) {
+        out_printf("Perf: not counted, start the job with bg --perf\n");
+    } else if(!read_ok) {
+        out_perror("Perf: reading the counters failed");
+    } else if(values.hardware) {
+        out_printf("Perf: hardware counters, counting %.0f%% of the time\n"
+               "Cycles: %llu\n"
+               "Instructions: %llu\n"
+               "IPC: %.2f\n"
+               "Cache_misses: %llu (%.2f per 1k instructions)\n"
+               "Branch_misses: %llu (%.2f per 1k instructions)\n",
+               values.running * 100, c[PERF_CYCLES], c[PERF_INSTRUCTIONS], ipc,
+               c[PERF_CACHE_MISSES], cache_mpki, c[PERF_BRANCH_MISSES], branch_mpki);
+    } else {
+        out_printf("Perf: software counters, no hardware counters available\n"
+               "Task_clock: %.3f ms\n"
+               "Page_faults: %llu\n"
+               "Context_switches: %llu\n"
+               "Cpu_migrations: %llu\n",
+               c[PERF_TASK_CLOCK] / 1e6, c[PERF_PAGE_FAULTS], c[PERF_CONTEXT_SWITCHES], c[PERF_CPU_MIGRATIONS]);
+    }
+}
+
+ /* Summary: Prints stats for proceses
+ * Description: Takes an array of pids and selectors that is null
+ * terminated. Gets the stats for each selected job, the /proc reads of
+ * all pids are spread over the procstat threads and printed in pid order.
+ * With --perf first, the perf counters of each job follow its stats
+ * Takes:
+ *        jobs: table of all programs
+ *        processes: optional --perf, then strings of process ids or selectors
+ * Returns: -1 if stats of any process were not printed, 0 otherwise
+ */
+int print_stats(jobtable * jobs, char * * processes) {
+    double ticks = sysconf(_SC_CLK_TCK);
+    int ret = 0;
+    int perf = 0;
+    if(processes[0] && strcmp(processes[0], "--perf") == 0) {
+        perf = 1;
+        processes++;
+    }
+    if(!processes[0]) {
+        out_printf("No program id provided\nusage: pstat [--perf] pid|selector [...]\n");
+        return -1;
+    }
+
+    subprogram * * selected;
+    int valid = select_jobs(jobs, processes, 0, "read stats of", &selected);
+    if(valid < 0) {
+        valid = -1 - valid;
+        ret = -1;
+    }
+
+    pid_t * pids = xmalloc_tagged(sizeof(pid_t) * (valid + 1), MEM_STATS); //one allocation per command for all results
+    procstat * stats = xmalloc_tagged(sizeof(procstat) * (valid + 1), MEM_STATS);
+    int * ok = xmalloc_tagged(sizeof(int) * (valid + 1), MEM_STATS);
+
+    int i;
+    for(i = 0; i < valid; i++) pids[i] = selected[i]->pid; //already in pid order
+    procstat_read_many(pids, stats, ok, valid);
+
+    for(i = 0; i < valid; i++) {
+        pid_t pid = pids[i];
+        if( !ok[i] ) {
+            out_printf("Skipping pid = %d .Failed to read from /proc/%d\n",pid,pid);
+            ret = -1;
+            continue;
+        }
+
+        subprogram * program = selected[i];
+        if(out_get_format() != OUT_HUMAN) {
+            out_record("stat");
+            out_field_int("pid", program->pid);
+            out_field_str("name", program->name);
+            char state[2] = {stats[i].state, 0};
+            out_field_str("state", state);
+            out_field_double("utime", stats[i].utime / ticks);
+            out_field_double("stime", stats[i].stime / ticks);
+            out_field_int("rss", stats[i].rss);
+            out_field_int("voluntary_ctxt_switches", stats[i].voluntary_ctxt_switches);
+            out_field_int("nonvoluntary_ctxt_switches", stats[i].nonvoluntary_ctxt_switches);
+            out_field_str("cpus_allowed", stats[i].cpus_allowed);
+            out_field_str("mems_allowed", stats[i].mems_allowed);
+            out_field_int("nice", stats[i].nice);
+            out_field_str("policy", placement_policy_name(stats[i].policy));
+            out_end_record();
+            if(perf) print_perf(program);
+            continue;
+        }
+        out_printf("Name: %s\n"
+               "Pid: %d\n"
+               "State: %c\n"
+               "Utime: %lf\n"
+               "Stime: %lf\n"
+               "Rss: %ld\n"
+               "Voluntary_ctxt_switches: %ld\n"
+               "Nonvoluntary_ctxt_swtitches: %ld\n"
+               "Cpus_allowed_list: %s\n"
+               "Mems_allowed_list: %s\n"
+               "Nice: %ld\n"
+               "Policy: %s\n",
+               program->name,
+               (int) program->pid,
+               stats[i].state,
+               stats[i].utime / ticks,
+               stats[i].stime / ticks,
+               stats[i].rss,
+               stats[i].voluntary_ctxt_switches,
+               stats[i].nonvoluntary_ctxt_switches,
+               stats[i].cpus_allowed,
+               stats[i].mems_allowed,
+               stats[i].nice,
+               placement_policy_name(stats[i].policy));
+        if(perf) print_perf(program);
+        out_printf("\n");
+    }
+
+    xfree(ok);
+    xfree(stats);
+    xfree(pids);
+    xfree(selected);
+    return ret;
+}
+
+
+/* Summary: Prints the process trees of jobs
+ * Description: Each selected job with its descendants indented under
+ * their parents, with cpu time and rss summed over the whole tree. The
+ * tree index is brought up to date first, only pids it has not seen are
+ * read in full. In json and tsv a tree record per process and a treesum
+ * record per job
+ * Takes:
+ *        jobs: table of all programs
+ *        args: pids or selectors, all jobs when empty
+ * Returns: -1 if any tree was not printed, 0 otherwise
+ */
+int print_tree(jobtable * jobs, char * * args) {
+    char * all[] = {"all", NULL};
+    if(!args[0]) {
+        if(!jobs->active.num) {
+            out_printf("No background jobs\n");
+            return 0;
+        }
+        args = all;
+    }
+
+    int ret = 0;
+    subprogram * * selected;
+    int num = select_jobs(jobs, args, 0, "print the tree of", &selected);
+    if(num < 0) {
+        num = -1 - num;
+        ret = -1;
+    }
+
+    double ticks = sysconf(_SC_CLK_TCK);
+    double page_mib = sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+    int human = out_get_format() == OUT_HUMAN;
+    proctree_scan(jobs); //once for all the trees
+    int i;
+    for(i = 0; i < num; i++) {
+        subprogram * program = selected[i];
+        proctree_member * members;
+        int count = proctree_collect(program, &members);
+        if(count < 0) {
+            out_printf("Skipping pid = %d .Failed to read from /proc/%d\n", program->pid, program->pid);
+            ret = -1;
+            continue;
+        }
+
+        unsigned long cpu = 0;
+        long rss = 0;
+        int j;
+        for(j = 0; j < count; j++) {
+            cpu += members[j].stats.utime + members[j].stats.stime;
+            rss += members[j].stats.rss;
+        }
+
+        if(human) {
+            out_printf("%s (pid=%d): %d processes, cpu %.2fs, rss %.1fMiB\n",
+                       program->name, program->pid, count, cpu / ticks, rss * page_mib);
+        }
+        for(j = 0; j < count; j++) {
+            const procstat * stats = &members[j].stats;
+            if(!human) {
+                out_record("tree");
+                out_field_int("root", program->pid);
+                out_field_int("pid", stats->pid);
+                out_field_int("ppid", stats->ppid);
+                out_field_int("depth", members[j].depth);
+                out_field_str("name", stats->comm);
+                char state[2] = {stats->state, 0};
+                out_field_str("state", state);
+                out_field_double("utime", stats->utime / ticks);
+                out_field_double("stime", stats->stime / ticks);
+                out_field_int("rss", stats->rss);
+                out_end_record();
+                continue;
+            }
+            out_printf("%*s%d %s %c cpu %.2fs rss %.1fMiB\n", 2 + 2 * members[j].depth, "", stats->pid,
+                       stats->comm, stats->state, (stats->utime + stats->stime) / ticks, stats->rss * page_mib);
+        }
+        if(!human) {
+            out_record("treesum");
+            out_field_int("pid", program->pid);
+            out_field_str("name", program->name);
+            out_field_int("processes", count);
+            out_field_double("cpu", cpu / ticks);
+            out_field_int("rss", rss);
+            out_end_record();
+        }
+        xfree(members);
+    }
+
+    xfree(selected);
+    return ret;
+}
+
+
+/* Prints what the kernel reported about an exited job, an exitstat
+ * record in json and tsv. Nothing without events on */
+static void print_trace(subprogram * program) {
+    job_trace * trace = program->trace;
+    if(!trace) return;
+    if(out_get_format() != OUT_HUMAN) {
+        out_record("exitstat");
+        out_field_int("pid", program->pid);
+        out_field_int("forks", trace->forks);
+        out_field_int("execs", trace->execs);
+        out_field_int("descendants", trace->descendants);
+        out_field_int("accounted", trace->accounted);
+        out_field_double("utime", trace->utime_us / 1e6);
+        out_field_double("stime", trace->stime_us / 1e6);
+        out_field_int("max_rss_kb", trace->max_rss_kb);
+        out_field_int("read_bytes", trace->read_bytes);
+        out_field_int("write_bytes", trace->write_bytes);
+        out_field_double("cpu_delay_ms", trace->cpu_delay_ns / 1e6);
+        out_field_double("blkio_delay_ms", trace->blkio_delay_ns / 1e6);
+        out_field_int("voluntary_ctxt_switches", trace->nvcsw);
+        out_field_int("nonvoluntary_ctxt_switches", trace->nivcsw);
+        out_end_record();
+        return;
+    }
+
+    out_printf("      forks %d, execs %d", trace->forks, trace->execs);
+    if(trace->descendants) out_printf(", %d descendants still running", trace->descendants);
+    if(trace->accounted) {
+        out_printf(", user %.3fs, sys %.3fs, max rss %lluKiB, read %lluB, written %lluB, cpu wait %.1fms, io wait %.1fms",
+                   trace->utime_us / 1e6, trace->stime_us / 1e6, trace->max_rss_kb, trace->read_bytes,
+                   trace->write_bytes, trace->cpu_delay_ns / 1e6, trace->blkio_delay_ns / 1e6);
+    }
+    out_printf("\n");
+}
+
+/* Summary: Prints all programs that are running or have exited
+ * Description: Prints two lists, ended and active programs. Exited jobs
+ * are reaped by the event loop, so this only reports them. In json and
+ * tsv an exited record per ended job (code is the exit status or the
+ * signal), a job record per active job and a bglist record with counts.
+ * With events on each exited job is followed by its kernel accounting.
+ * Takes:
+ *        jobs: table of all programs
+ */
+void check_execution(jobtable * jobs) {
+
+    reap_children(jobs); //catch exits the event loop has not handled yet
+    events_drain(); //accounting is sent before the exit is, so it is queued by now
+    int human = out_get_format() == OUT_HUMAN;
+
+    if(human) out_printf("Exited jobs\n"
+                         "Pid   Name   Exit Reason\n");
+
+    int exited = 0;
+    while(jobs->exited.num) {
+        ADThashnode * node = adtPopHashNode(&jobs->exited,jobs->exited.head->key);
+        subprogram * program = (subprogram *) node->val;
+        exited++;
+
+        if(!human && (WIFSIGNALED(program->status) || WIFEXITED(program->status))) {
+            int killed = WIFSIGNALED(program->status);
+            out_record("exited");
+            out_field_int("pid", program->pid);
+            out_field_str("name", program->name);
+            out_field_str("reason", killed ? "killed" : "exited");
+            out_field_int("code", killed ? WTERMSIG(program->status) : WEXITSTATUS(program->status));
+            out_end_record();
+        } else if(WIFSIGNALED(program->status)) { //two casses
+            out_printf("%d  %s  Killed\n", program->pid, program->name);
+        } else if (WIFEXITED(program->status)) { //two casses
+            out_printf("%d  %s  Exited\n", program->pid, program->name);
+        } else {
+            fprintf(stderr,"WARNING: got signal with no handaler(pid=%d)\n",program->pid);
+        }
+        print_trace(program);
+        proctree_disown(program->pid);
+        free_node(node);
+    }
+
+    if(human) out_printf("Newly finished jobs: %d\n\n"
+                         "Background Jobs\n"
+                         "Pid    Name\n", exited);
+
+    ADThashnode * node = jobs->active.head;
+    while(node) {
+        subprogram * program = (subprogram *) node->val;
+        if(!human) {
+            out_record("job");
+            out_field_int("pid", program->pid);
+            out_field_str("name", program->name);
+            out_field_str("group", program->group ? program->group->name : "");
+            out_end_record();
+        } else if(program->group) {
+            out_printf("%d  %s  @%s\n", program->pid, program->name, program->group->name);
+        } else {
+            out_printf("%d  %s\n", program->pid, program->name);
+        }
+        node = node->next;
+    }
+
+    if(human) {
+        out_printf("Total background jobs: %d\n", jobs->active.num);
+    } else {
+        out_record("bglist");
+        out_field_int("finished", exited);
+        out_field_int("active", jobs->active.num);
+        out_end_record();
+    }
+}
+
+
+/* Summary: Prints the tail of a job's captured output
+ * Description: Waiting output is drained first, so the tail is current
+ * even when the event loop has not run. Exited jobs keep their output
+ * until bglist reports them
+ * Takes:
+ *        jobs: table of all programs
+ *        args: pid, then an optional number of lines (10 by default) or all
+ * Returns: -1 on failure, 0 otherwise
+ */
+int print_output(jobtable * jobs, char * * args) {
+    pid_t pid = args[0] ? extract_pid(args[0]) : -1;
+    int lines = 10;
+    if(args[1] && strcmp(args[1], "all") == 0) lines = 0;
+    else if(args[1]) lines = extract_pid(args[1]);
+    if(pid <= 0 || lines < 0 || (args[1] && args[2])) {
+        out_printf("Invalid pid or number of lines\nusage: bgout pid [lines|all]\n");
+        return -1;
+    }
+
+    ADThashnode * node = adtFindHashNode(&jobs->active, pid);
+    if(!node) node = adtFindHashNode(&jobs->exited, pid);
+    if(!node) {
+        out_printf("Cannot print output of %d(PID UNKNOWN) \n", pid);
+        return -1;
+    }
+    subprogram * program = (subprogram *) node->val;
+    if(!program->capture) {
+        out_printf("%s (pid=%d) was not started with --capture\n", program->name, pid);
+        return -1;
+    }
+
+    capture_drain(program->capture);
+    int len;
+    char * tail = capture_tail(program->capture, lines, &len);
+    if(out_get_format() != OUT_HUMAN) {
+        char * line = tail;
+        while(line < tail + len) {
+            char * end = memchr(line, '\n', tail + len - line);
+            if(!end) end = tail + len;
+            *end = 0; //the copy has room for a null after the last byte
+            out_record("line");
+            out_field_int("pid", pid);
+            out_field_str("text", line);
+            out_end_record();
+            line = end + 1;
+        }
+    } else if(len) {
+        out_printf("%.*s%s", len, tail, tail[len - 1] == '\n' ? "" : "\n");
+    } else {
+        out_printf("No output captured from %s (pid=%d)\n", program->name, pid);
+    }
+    xfree(tail);
+    return 0;
+}
+
+
+/* Prints the allocation counters of every tag and their totals */
+void print_memory(void) {
+    if(out_get_format() == OUT_HUMAN) {
+        out_printf("%-8s %12s %12s %12s %12s\n", "Tag", "Live bytes", "Live allocs", "Peak bytes", "Allocs");
+    }
+    int tag;
+    for(tag = 0; tag <= MEM_TAGS; tag++) {
+        mem_stats stats;
+        mem_get_stats(tag, &stats);
+        if(out_get_format() != OUT_HUMAN) {
+            out_record("memstat");
+            out_field_str("tag", mem_tag_name(tag));
+            out_field_int("live_bytes", stats.live_bytes);
+            out_field_int("live_allocs", stats.live_allocs);
+            out_field_int("peak_bytes", stats.peak_bytes);
+            out_field_int("allocs", stats.allocs);
+            out_end_record();
+            continue;
+        }
+        out_printf("%-8s %12ld %12ld %12ld %12ld\n", mem_tag_name(tag), stats.live_bytes, stats.live_allocs,
+                   stats.peak_bytes, stats.allocs);
+    }
+}
+
+
+/* Prints the occupancy of the job record pool */
+void print_job_pool(void) {
+    job_pool_stats stats;
+    job_get_pool_stats(&stats);
+    if(out_get_format() != OUT_HUMAN) {
+        out_record("jobpool");
+        out_field_int("used", stats.used);
+        out_field_int("capacity", stats.capacity);
+        out_field_int("slabs", stats.slabs);
+        out_field_int("record_bytes", sizeof(subprogram));
+        out_field_int("interned", stats.interned);
+        out_field_int("interned_refs", stats.interned_refs);
+        out_end_record();
+        return;
+    }
+    out_printf("Job records: %d used of %d (%.1f%%) in %d slabs of %d bytes each\n"
+           "Interned names: %d distinct, used by %d jobs\n",
+           stats.used, stats.capacity, stats.capacity ? 100.0 * stats.used / stats.capacity : 0.0,
+           stats.slabs, (int) sizeof(subprogram), stats.interned, stats.interned_refs);
+}
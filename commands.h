@@ -0,0 +1,103 @@
+/* Commands of pman that manage background jobs. Each prints its own
+ * results and messages */
+
+#ifndef _COMMANDS_H
+#define _COMMANDS_H
+
+#include <sys/types.h>
+
+#include "ADThashtable.h"
+#include "groups.h"
+#include "jobs.h"
+#include "placement.h"
+#include "watchdog.h"
+
+/* Struct for the options of bg and bgmany, given before the program */
+typedef struct job_options {
+    jobgroup * group; //NULL to start jobs in pman's process group
+    int capture; //keep stdout and stderr in a ring for bgout
+    int perf; //attach perf counters before exec, for pstat --perf
+    placement place; //cpus, node, nice, policy and spread
+    job_limits limits; //enforced by the watchdog
+} job_options;
+
+/* Specialized memory freeing funtion ADThash node inside a subprogram*/
+void free_node(ADThashnode * node);
+
+/* Adds a started child to the active jobs, named after its program
+ * group may be NULL, the child must already have joined it
+ * Returns: the new job */
+subprogram * add_job(jobtable * jobs, pid_t child, char * program, jobgroup * group);
+
+/* Summary: Parses the leading --options of bg and bgmany
+ * Takes:
+ *        args: arguements, options first
+ *        options: set to the parsed options
+ * Returns: number of arguements used by options, -1 on an invalid option */
+int parse_job_options(char * * args, job_options * options);
+
+/* Summary: Starts a background job without printing
+ * Takes:
+ *        jobs: table of all programs
+ *        args: arguements, first is the program
+ *        options: options of the job, may be NULL
+ *        err: set to the errno of the failed call on failure, or why
+ *             perf counters asked for could not be attached
+ * Returns: the new job, NULL on failure */
+subprogram * start_job(jobtable * jobs, char * * args, const job_options * options, int * err);
+
+/* Starts args[0] with args as a background job, after options as parsed
+ * by parse_job_options
+ * Returns: -1 on failure, 0 otherwise
+ * */
+int create_process(jobtable * jobs, char * args[]);
+
+/* Starts one job per arguement array of the null terminated specs, all
+ * exec confirmations are collected together. options may be NULL
+ * Returns: -1 if any job failed to start, 0 otherwise
+ * */
+int create_processes(jobtable * jobs, char * * * specs, const job_options * options);
+
+/* Runs the bgmany command with the arguements after bgmany
+ * Returns: -1 on failure, 0 otherwise
+ * */
+int create_many(jobtable * jobs, char * * args);
+
+/* Runs the bgout command with the arguements after bgout
+ * Returns: -1 on failure, 0 otherwise
+ * */
+int print_output(jobtable * jobs, char * * args);
+
+/* Moves every exited child from the active to the exited jobs */
+void reap_children(jobtable * jobs);
+
+/* Sends signal to each job in the null terminated pid strings, and to
+ * each @group as a whole. With --tree first descendants of the jobs too
+ * Returns: -1 if any process was not signalled, 0 otherwise
+ * */
+int send_signal(jobtable * jobs, char * * processes, int signal);
+
+/* Sort pids in increasing order, for qsort */
+int compare_pids(const void * val1, const void * val2);
+
+/* Prints stats for each job in the null terminated pid strings
+ * Returns: -1 if stats of any process were not printed, 0 otherwise
+ * */
+int print_stats(jobtable * jobs, char * * processes);
+
+/* Prints the process tree of each job in the null terminated pid
+ * strings, of every job when there are none
+ * Returns: -1 if any tree was not printed, 0 otherwise
+ * */
+int print_tree(jobtable * jobs, char * * args);
+
+/* Prints exited jobs since the last call, then all active jobs */
+void check_execution(jobtable * jobs);
+
+/* Prints the allocation counters of every tag and their totals */
+void print_memory(void);
+
+/* Prints the occupancy of the job record pool */
+void print_job_pool(void);
+
+#endif
@@ -0,0 +1,281 @@
+/* Control socket implementation code */
+
+#define MEM_TAG MEM_OUTPUT
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+#include "output.h"
+#include "utils.h"
+
+/* Struct for a connected client */
+typedef struct control_client {
+    int fd;
+    outbuf in; //received bytes not yet run
+    outbuf out; //replies not yet written
+    unsigned int events; //events watched in the loop
+    int eof; //the peer is done sending
+    int closing; //all input ran or exit, close once out is written
+    out_format format; //output format of the client's commands
+    struct control_client * next;
+    struct control_client * prev;
+} control_client;
+
+static evloop * control_loop = NULL;
+static control_handler control_run = NULL;
+static int listen_fd = -1;
+static char * socket_path = NULL;
+static control_client * clients = NULL;
+static outbuf reply; //output of the running command, reused for every command
+
+/* Closes a client and frees it */
+static void close_client(control_client * client) {
+    evloop_remove(control_loop, client->fd);
+    close(client->fd);
+    if(client->prev) client->prev->next = client->next;
+    else clients = client->next;
+    if(client->next) client->next->prev = client->prev;
+    outbuf_free(&client->in);
+    outbuf_free(&client->out);
+    xfree(client);
+}
+
+/* Runs one line and queues its reply */
+static void run_line(control_client * client, char * line, int len) {
+    if(len && line[len - 1] == '\r') line[--len] = 0;
+
+    int ret = 0;
+    reply.len = 0;
+    char * * tokens = get_tokens(line);
+    int leaving = tokens && strcmp(tokens[0], "exit") == 0; //exit ends the client, not pman
+    if(tokens) free_tokens(tokens);
+    if(leaving) {
+        client->closing = 1;
+    } else {
+        outbuf * previous = out_capture(&reply);
+        out_format saved = out_set_format(client->format); //each client has its own format
+        ret = control_run(line);
+        out_flush();
+        client->format = out_set_format(saved);
+        out_capture(previous);
+    }
+
+    char header[32];
+    int header_len = snprintf(header, sizeof(header), "%s %d\n", ret < 0 ? "ERR" : "OK", reply.len);
+    outbuf_append(&client->out, header, header_len);
+    if(reply.len) outbuf_append(&client->out, reply.data, reply.len);
+}
+
+/* Runs every complete line the client sent, until its replies reach the limit
+ * A line longer than the limit gets an error and closes the client, complete
+ * lines waiting for the replies to drain are kept however many there are */
+static void run_lines(control_client * client) {
+    int start = 0;
+    int too_long = 0;
+    while(!client->closing && client->out.len < CONTROL_OUT_LIMIT) {
+        char * line = client->in.data + start;
+        int left = client->in.len - start;
+        char * end = memchr(line, '\n', left < CONTROL_LINE_MAX + 1 ? left : CONTROL_LINE_MAX + 1);
+        if(!end) {
+            too_long = left > CONTROL_LINE_MAX; //otherwise the rest of the line is still coming
+            break;
+        }
+        *end = 0;
+        run_line(client, line, end - line);
+        start += end - line + 1;
+    }
+
+    if(client->closing) start = client->in.len; //input after exit is ignored
+    if(start) outbuf_consume(&client->in, start);
+    if(client->eof && client->in.len == 0) client->closing = 1;
+
+    if(too_long) {
+        const char * error = "Command line too long\n";
+        char header[32];
+        int header_len = snprintf(header, sizeof(header), "ERR %d\n", (int) strlen(error));
+        outbuf_append(&client->out, header, header_len);
+        outbuf_append(&client->out, error, strlen(error));
+        client->in.len = 0;
+        client->closing = 1;
+    }
+}
+
+/* Writes pending replies, then watches for the events the client needs
+ * Returns: -1 if the client was closed, 0 otherwise */
+static int flush_client(control_client * client) {
+    int written = 0;
+    while(written < client->out.len) {
+        ssize_t ret = send(client->fd, client->out.data + written, client->out.len - written, MSG_NOSIGNAL);
+        if(ret < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN) break;
+            close_client(client); //the peer is gone
+            return -1;
+        }
+        written += ret;
+    }
+    if(written) outbuf_consume(&client->out, written);
+
+    if(client->closing && client->out.len == 0) {
+        close_client(client);
+        return -1;
+    }
+
+    unsigned int events = 0;
+    if(!client->eof && !client->closing && client->out.len < CONTROL_OUT_LIMIT) events |= EPOLLIN; //backpressure
+    if(client->out.len) events |= EPOLLOUT;
+    if(events != client->events) {
+        evloop_modify(control_loop, client->fd, events);
+        client->events = events;
+    }
+    return 0;
+}
+
+/* Event loop callback for a client, reads all available commands, runs
+ * them and writes as much of the replies as the socket takes */
+static void on_client(int fd, unsigned int events, void * data) {
+    control_client * client = data;
+
+    if(events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        char chunk[16384];
+        while(!client->eof && !client->closing) {
+            ssize_t ret = read(fd, chunk, sizeof(chunk));
+            if(ret < 0) {
+                if(errno == EINTR) continue;
+                if(errno == EAGAIN) break;
+                close_client(client);
+                return;
+            }
+            if(ret == 0) { //the peer is done sending, a last line may lack its newline
+                if(client->in.len && client->in.data[client->in.len - 1] != '\n') {
+                    outbuf_append(&client->in, "\n", 1);
+                }
+                client->eof = 1;
+                break;
+            }
+            outbuf_append(&client->in, chunk, ret);
+            if(client->in.len > CONTROL_LINE_MAX || client->out.len >= CONTROL_OUT_LIMIT) break; //run what is read first
+        }
+    }
+
+    run_lines(client);
+    flush_client(client);
+}
+
+/* Event loop callback for the socket, accepts every waiting client */
+static void on_accept(int fd, unsigned int events, void * data) {
+    (void) events; (void) data;
+    while(1) {
+        int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(client_fd < 0) {
+            if(errno == EINTR) continue;
+            if(errno != EAGAIN) perror("Warning. Accepting a control client failed");
+            return;
+        }
+
+        control_client * client = xmalloc(sizeof(control_client));
+        client->fd = client_fd;
+        outbuf_init(&client->in);
+        outbuf_init(&client->out);
+        client->events = EPOLLIN;
+        client->eof = 0;
+        client->closing = 0;
+        client->format = OUT_HUMAN;
+        if(evloop_add(control_loop, client_fd, EPOLLIN, on_client, client) < 0) {
+            perror("Warning. Watching a control client failed");
+            close(client_fd);
+            xfree(client);
+            continue;
+        }
+        client->prev = NULL;
+        client->next = clients;
+        if(clients) clients->prev = client;
+        clients = client;
+    }
+}
+
+/* Summary: Listens for clients on a unix socket
+ * Description: A stale socket file at path is replaced, one another pman
+ * still listens on is not. The socket is made accessible to the owner
+ * only. Commands of clients run through handler, except exit which
+ * closes the connection
+ * Takes:
+ *        loop: event loop that serves the socket and its clients
+ *        path: path of the socket
+ *        handler: runs each command
+ * Returns: -1 on failure and sets errno, 0 otherwise */
+int control_listen(evloop * loop, const char * path, control_handler handler) {
+    struct sockaddr_un addr;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    struct stat info;
+    if(lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(probe < 0) return -1;
+        int live = connect(probe, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+        int refused = !live && errno == ECONNREFUSED;
+        close(probe);
+        if(live) {
+            errno = EADDRINUSE; //another pman serves it
+            return -1;
+        }
+        if(refused) unlink(path); //left by an old pman
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) return -1;
+    mode_t mask = umask(0077); //clients can run anything as this user
+    int bound = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    umask(mask);
+    if(bound < 0 || listen(fd, SOMAXCONN) < 0
+       || evloop_add(loop, fd, EPOLLIN, on_accept, NULL) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    control_loop = loop;
+    control_run = handler;
+    listen_fd = fd;
+    socket_path = xmalloc(strlen(path) + 1);
+    strcpy(socket_path, path);
+    outbuf_init(&reply);
+    return 0;
+}
+
+/* Checks if the socket is being served */
+int control_active(void) {
+    return listen_fd >= 0;
+}
+
+/* Closes all clients and the socket, and removes the socket file */
+void control_close(void) {
+    if(listen_fd < 0) return;
+    while(clients) {
+        control_client * client = clients;
+        if(flush_client(client) == 0) close_client(client); //best effort, the socket is nonblocking
+    }
+    evloop_remove(control_loop, listen_fd);
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+    xfree(socket_path);
+    outbuf_free(&reply);
+}
@@ -0,0 +1,36 @@
+/* Control socket header. pman listens on a unix socket and runs each line
+ * a client sends as a command, from the same event loop as the prompt.
+ * Clients may pipeline commands, replies come back in order as
+ * "OK <length>\n<output>" or "ERR <length>\n<output>" */
+
+#ifndef _CONTROL_H
+#define _CONTROL_H
+
+#include "evloop.h"
+
+#define CONTROL_LINE_MAX 65536 //longest command line accepted
+#define CONTROL_OUT_LIMIT (1 << 20) //pending reply bytes that pause reading from a client
+
+/* Runs one command line, its output printed with out_printf
+ * Returns: -1 if the command failed, 0 otherwise */
+typedef int (*control_handler)(char * line);
+
+/* Summary: Listens for clients on a unix socket
+ * Description: A stale socket file at path is replaced, one another pman
+ * still listens on is not. The socket is made accessible to the owner
+ * only. Commands of clients run through handler, except exit which
+ * closes the connection
+ * Takes:
+ *        loop: event loop that serves the socket and its clients
+ *        path: path of the socket
+ *        handler: runs each command
+ * Returns: -1 on failure and sets errno, 0 otherwise */
+int control_listen(evloop * loop, const char * path, control_handler handler);
+
+/* Checks if the socket is being served */
+int control_active(void);
+
+/* Closes all clients and the socket, and removes the socket file */
+void control_close(void);
+
+#endif
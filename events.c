@@ -0,0 +1,526 @@
+/* Kernel event feed implementation code */
+
+#define MEM_TAG MEM_JOBS
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/taskstats.h>
+
+#include "events.h"
+#include "output.h"
+#include "proctree.h"
+#include "utils.h"
+
+#define EVENTS_BUFFER_SIZE 16384
+#define EVENTS_RCVBUF (1 << 20) //exits are reported system wide, bursts must fit
+#define EVENTS_REPLY_TIMEOUT 1000 //ms the kernel gets to answer a request
+
+/* Struct for a process started by a job or one of its descendants */
+typedef struct descendant {
+    ADThashnode node; //keyed by pid
+    pid_t root; //pid of the job
+} descendant;
+
+/* Struct for a generic netlink request with room for its attributes */
+typedef struct genl_request {
+    struct nlmsghdr header;
+    struct genlmsghdr genl;
+    char attrs[256];
+} genl_request;
+
+static evloop * events_loop = NULL;
+static jobtable * events_jobs = NULL;
+static ADThashtable descendants;
+
+static int proc_fd = -1; //proc connector socket
+static int stats_fd = -1; //taskstats socket
+static int stats_family = 0; //generic netlink id of taskstats
+static char stats_cpus[256]; //cpumask registered for exit accounting
+
+static unsigned long messages = 0;
+static unsigned long lost = 0; //times the kernel dropped messages for a full socket
+
+static char buffer[EVENTS_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+/* Match events against jobs, dispatched from loop. Must be called before events_start */
+void events_init(evloop * loop, jobtable * jobs) {
+    events_loop = loop;
+    events_jobs = jobs;
+    adtInitiateHashTable(&descendants);
+}
+
+/* Job with pid, running or exited but not reported yet
+ * Returns: the job, NULL if pid is not a job */
+static subprogram * find_job(pid_t pid) {
+    ADThashnode * node = adtFindHashNode(&events_jobs->active, pid);
+    if(!node) node = adtFindHashNode(&events_jobs->exited, pid);
+    return node ? (subprogram *) node->val : NULL;
+}
+
+/* Trace of a job, created on its first event */
+static job_trace * trace_of(subprogram * job) {
+    if(!job->trace) {
+        job->trace = xmalloc(sizeof(job_trace));
+        memset(job->trace, 0, sizeof(job_trace));
+    }
+    return job->trace;
+}
+
+/* Job a process belongs to, itself or the job it descends from
+ * Returns: the job, NULL if it belongs to none */
+static subprogram * owner_of(pid_t pid) {
+    subprogram * job = find_job(pid);
+    if(job) return job;
+    ADThashnode * node = adtFindHashNode(&descendants, pid);
+    return node ? find_job(((descendant *) node->val)->root) : NULL;
+}
+
+/* A process forked, child is tracked when parent belongs to a job */
+static void process_forked(pid_t parent, pid_t child) {
+    subprogram * job = owner_of(parent);
+    proctree_forked(parent, child, job ? job->pid : 0);
+    if(!job) return;
+
+    ADThashnode * stale = adtPopHashNode(&descendants, child); //exit was lost, the pid is reused
+    if(stale) xfree(stale->val);
+    descendant * desc = xmalloc(sizeof(descendant));
+    adtInitiateHashNode(&desc->node, child, desc);
+    desc->root = job->pid;
+    adtAddHashNode(&descendants, &desc->node);
+
+    job_trace * trace = trace_of(job);
+    trace->forks++;
+    trace->descendants++;
+}
+
+/* A process exec'd */
+static void process_execd(pid_t pid) {
+    subprogram * job = owner_of(pid);
+    if(job) trace_of(job)->execs++;
+}
+
+/* A process exited, it is forgotten if it descended from a job */
+static void process_exited(pid_t pid) {
+    proctree_exited(pid);
+    ADThashnode * node = adtPopHashNode(&descendants, pid);
+    if(!node) return;
+    subprogram * job = find_job(((descendant *) node->val)->root);
+    if(job && job->trace && job->trace->descendants > 0) job->trace->descendants--;
+    xfree(node->val);
+}
+
+/* Summary: Handles proc connector messages
+ * Takes:
+ *        data: messages received
+ *        len: bytes of data
+ * Returns: the error of the listen acknowledgement when data has one,
+ * -1 otherwise */
+static int handle_proc(const char * data, int len) {
+    int ack = -1;
+    const struct nlmsghdr * msg;
+    for(msg = (const struct nlmsghdr *) data; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+        if(msg->nlmsg_type == NLMSG_ERROR || msg->nlmsg_type == NLMSG_NOOP) continue;
+        const struct cn_msg * cn = NLMSG_DATA(msg);
+        if(cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC) continue;
+        const struct proc_event * event = (const struct proc_event *) cn->data;
+
+        switch(event->what) {
+        case PROC_EVENT_NONE:
+            ack = event->event_data.ack.err;
+            break;
+        case PROC_EVENT_FORK:
+            messages++;
+            if(event->event_data.fork.child_pid == event->event_data.fork.child_tgid) { //threads are not processes
+                process_forked(event->event_data.fork.parent_tgid, event->event_data.fork.child_tgid);
+            }
+            break;
+        case PROC_EVENT_EXEC:
+            messages++;
+            process_execd(event->event_data.exec.process_tgid);
+            break;
+        case PROC_EVENT_EXIT:
+            messages++;
+            if(event->event_data.exit.process_pid == event->event_data.exit.process_tgid) {
+                process_exited(event->event_data.exit.process_tgid);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return ack;
+}
+
+/* Keeps the exit accounting of pid if it is a job. whole is set for the
+ * thread group totals, sent when a multithreaded process ends. They
+ * replace the cpu fields of its main thread, the memory and io fields
+ * only come per thread */
+static void account(pid_t pid, const struct taskstats * stats, int whole) {
+    subprogram * job = find_job(pid);
+    if(!job) return;
+    job_trace * trace = trace_of(job);
+
+    if(whole || !trace->whole) {
+        trace->utime_us = stats->ac_utime;
+        trace->stime_us = stats->ac_stime;
+        trace->cpu_delay_ns = stats->cpu_delay_total;
+        trace->blkio_delay_ns = stats->blkio_delay_total;
+        trace->nvcsw = stats->nvcsw;
+        trace->nivcsw = stats->nivcsw;
+    }
+    if(!whole) {
+        trace->read_bytes = stats->read_bytes;
+        trace->write_bytes = stats->write_bytes;
+        trace->max_rss_kb = stats->hiwater_rss;
+    }
+    trace->whole |= whole;
+    trace->accounted = 1;
+}
+
+/* Checks that attr fits in the left bytes */
+static int attr_ok(const struct nlattr * attr, int left) {
+    return left >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN && attr->nla_len <= left;
+}
+
+/* Attribute after attr, left is reduced by attr */
+static const struct nlattr * attr_next(const struct nlattr * attr, int * left) {
+    *left -= NLA_ALIGN(attr->nla_len);
+    return (const struct nlattr *) ((const char *) attr + NLA_ALIGN(attr->nla_len));
+}
+
+/* Handles a pid or tgid aggregate, a pid followed by its stats */
+static void handle_aggregate(const struct nlattr * aggregate, int whole) {
+    pid_t pid = 0;
+    struct taskstats stats;
+    memset(&stats, 0, sizeof(stats));
+    int left = aggregate->nla_len - NLA_HDRLEN;
+    const struct nlattr * attr = (const struct nlattr *) ((const char *) aggregate + NLA_HDRLEN);
+    for(; attr_ok(attr, left); attr = attr_next(attr, &left)) {
+        int len = attr->nla_len - NLA_HDRLEN;
+        const char * payload = (const char *) attr + NLA_HDRLEN;
+        if((attr->nla_type == TASKSTATS_TYPE_PID || attr->nla_type == TASKSTATS_TYPE_TGID) && len >= 4) {
+            memcpy(&pid, payload, sizeof(pid));
+        } else if(attr->nla_type == TASKSTATS_TYPE_STATS) { //the kernel's struct may be older or newer
+            memcpy(&stats, payload, len < (int) sizeof(stats) ? len : (int) sizeof(stats));
+        }
+    }
+    if(pid > 0) account(pid, &stats, whole);
+}
+
+/* Summary: Handles taskstats and generic netlink control messages
+ * Description: Exit accounting is kept for jobs, the family id is taken
+ * from a control reply
+ * Takes:
+ *        data: messages received
+ *        len: bytes of data
+ * Returns: the error of an acknowledgement or the 0 of a control reply
+ * when data has one, -1 otherwise */
+static int handle_stats(const char * data, int len) {
+    int reply = -1;
+    const struct nlmsghdr * msg;
+    for(msg = (const struct nlmsghdr *) data; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+        if(msg->nlmsg_type == NLMSG_ERROR) {
+            reply = -((const struct nlmsgerr *) NLMSG_DATA(msg))->error;
+            continue;
+        }
+        if(msg->nlmsg_type != GENL_ID_CTRL && msg->nlmsg_type != stats_family) continue;
+
+        const struct genlmsghdr * genl = NLMSG_DATA(msg);
+        int left = msg->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+        const struct nlattr * attr = (const struct nlattr *) ((const char *) genl + GENL_HDRLEN);
+        if(msg->nlmsg_type == GENL_ID_CTRL) {
+            for(; attr_ok(attr, left); attr = attr_next(attr, &left)) {
+                if(attr->nla_type == CTRL_ATTR_FAMILY_ID) stats_family = *(const __u16 *) ((const char *) attr + NLA_HDRLEN);
+            }
+            reply = 0;
+            continue;
+        }
+
+        if(genl->cmd != TASKSTATS_CMD_NEW) continue;
+        messages++;
+        for(; attr_ok(attr, left); attr = attr_next(attr, &left)) {
+            if(attr->nla_type == TASKSTATS_TYPE_AGGR_PID) handle_aggregate(attr, 0);
+            else if(attr->nla_type == TASKSTATS_TYPE_AGGR_TGID) handle_aggregate(attr, 1);
+        }
+    }
+    return reply;
+}
+
+/* Receives the next datagram into buffer without blocking
+ * Returns: bytes received, 0 when nothing is waiting */
+static int receive(int fd) {
+    while(1) {
+        ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+        if(len >= 0) return len;
+        if(errno == EINTR) continue;
+        if(errno == ENOBUFS) { //the socket overflowed, it stays usable
+            lost++;
+            continue;
+        }
+        if(errno != EAGAIN) perror("Warning. Reading kernel events failed"); //also runs between commands
+        return 0;
+    }
+}
+
+/* Handles messages on fd until one answers the request just sent
+ * Returns: -1 with errno set if the kernel refused or did not answer, 0 otherwise */
+static int wait_reply(int fd, int (*handle)(const char * data, int len)) {
+    while(1) {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, EVENTS_REPLY_TIMEOUT);
+        if(ready < 0 && errno == EINTR) continue;
+        if(ready < 0) return -1;
+        if(ready == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
+        int len = receive(fd);
+        int reply = len ? handle(buffer, len) : -1;
+        if(reply > 0) {
+            errno = reply;
+            return -1;
+        }
+        if(reply == 0) return 0;
+    }
+}
+
+/* Read every message waiting on the proc connector */
+static void on_proc(int fd, unsigned int events, void * data) {
+    (void) events; (void) data;
+    int len;
+    while((len = receive(fd)) > 0) handle_proc(buffer, len);
+}
+
+/* Read every message waiting on the taskstats socket */
+static void on_stats(int fd, unsigned int events, void * data) {
+    (void) events; (void) data;
+    int len;
+    while((len = receive(fd)) > 0) handle_stats(buffer, len);
+}
+
+/* Opens a nonblocking netlink socket of protocol joined to the multicast groups
+ * Returns: the socket, -1 on failure with errno set */
+static int open_socket(int protocol, unsigned int groups) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+    if(fd < 0) return -1;
+    int size = EVENTS_RCVBUF;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)); //capped by rmem_max, the default works too
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = groups;
+    if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) { //joining the proc group needs CAP_NET_ADMIN
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+/* Sends a listen or ignore to the proc connector
+ * Returns: -1 on failure with errno set, 0 otherwise */
+static int proc_request(enum proc_cn_mcast_op op) {
+    char message[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))] __attribute__((aligned(NLMSG_ALIGNTO)));
+    memset(message, 0, sizeof(message));
+    struct nlmsghdr * header = (struct nlmsghdr *) message;
+    header->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+    header->nlmsg_type = NLMSG_DONE;
+    struct cn_msg * cn = NLMSG_DATA(header);
+    cn->id.idx = CN_IDX_PROC;
+    cn->id.val = CN_VAL_PROC;
+    cn->len = sizeof(op);
+    memcpy(cn->data, &op, sizeof(op));
+    return send(proc_fd, message, header->nlmsg_len, 0) < 0 ? -1 : 0;
+}
+
+/* Subscribe to fork, exec and exit events
+ * Returns: -1 on failure with errno set, 0 otherwise */
+static int start_proc(void) {
+    proc_fd = open_socket(NETLINK_CONNECTOR, CN_IDX_PROC);
+    if(proc_fd < 0) return -1;
+    if(proc_request(PROC_CN_MCAST_LISTEN) < 0 || wait_reply(proc_fd, handle_proc) < 0
+       || evloop_add(events_loop, proc_fd, EPOLLIN, on_proc, NULL) < 0) {
+        int err = errno;
+        close(proc_fd);
+        proc_fd = -1;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/* Set up a generic netlink request of type for cmd */
+static void init_request(genl_request * req, int type, int flags, int cmd, int version) {
+    memset(req, 0, sizeof(*req));
+    req->header.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    req->header.nlmsg_type = type;
+    req->header.nlmsg_flags = NLM_F_REQUEST | flags;
+    req->genl.cmd = cmd;
+    req->genl.version = version;
+}
+
+/* Append an attribute to req */
+static void add_attr(genl_request * req, int type, const void * data, int len) {
+    struct nlattr * attr = (struct nlattr *) ((char *) req + NLMSG_ALIGN(req->header.nlmsg_len));
+    attr->nla_type = type;
+    attr->nla_len = NLA_HDRLEN + len;
+    memcpy((char *) attr + NLA_HDRLEN, data, len);
+    req->header.nlmsg_len = NLMSG_ALIGN(req->header.nlmsg_len) + NLA_ALIGN(attr->nla_len);
+}
+
+/* Sends a registration change of stats_cpus, attr picks register or deregister
+ * Returns: -1 on failure with errno set, 0 otherwise */
+static int stats_request(int attr, int flags) {
+    genl_request req;
+    init_request(&req, stats_family, flags, TASKSTATS_CMD_GET, TASKSTATS_GENL_VERSION);
+    add_attr(&req, attr, stats_cpus, strlen(stats_cpus) + 1);
+    return send(stats_fd, &req, req.header.nlmsg_len, 0) < 0 ? -1 : 0;
+}
+
+/* Sets stats_cpus to every possible cpu, taskstats reports the exits
+ * on the cpus a listener registered for */
+static void read_possible_cpus(void) {
+    FILE * fp = fopen("/sys/devices/system/cpu/possible", "r");
+    if(!fp || !fgets(stats_cpus, sizeof(stats_cpus), fp)) {
+        snprintf(stats_cpus, sizeof(stats_cpus), "0-%ld", sysconf(_SC_NPROCESSORS_CONF) - 1);
+    }
+    if(fp) fclose(fp);
+    stats_cpus[strcspn(stats_cpus, "\n")] = 0;
+}
+
+/* Register for the exit accounting of every process
+ * Returns: -1 on failure with errno set, 0 otherwise */
+static int start_stats(void) {
+    stats_fd = open_socket(NETLINK_GENERIC, 0);
+    if(stats_fd < 0) return -1;
+
+    genl_request req;
+    init_request(&req, GENL_ID_CTRL, 0, CTRL_CMD_GETFAMILY, 1);
+    add_attr(&req, CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME));
+    stats_family = 0;
+    int ret = send(stats_fd, &req, req.header.nlmsg_len, 0) < 0 ? -1 : wait_reply(stats_fd, handle_stats);
+    if(ret == 0 && !stats_family) {
+        errno = ENOENT;
+        ret = -1;
+    }
+
+    if(ret == 0) {
+        read_possible_cpus();
+        if(stats_request(TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, NLM_F_ACK) < 0 || wait_reply(stats_fd, handle_stats) < 0
+           || evloop_add(events_loop, stats_fd, EPOLLIN, on_stats, NULL) < 0) ret = -1;
+    }
+    if(ret < 0) {
+        int err = errno;
+        close(stats_fd);
+        stats_fd = -1;
+        errno = err;
+    }
+    return ret;
+}
+
+/* Summary: Subscribes to the proc connector and taskstats
+ * Description: Each is optional, one that can not be opened (no
+ * CAP_NET_ADMIN, not in the initial network namespace, kernel built
+ * without it) is reported and the other still used
+ * Returns: -1 if neither could be opened, 0 otherwise */
+int events_start(void) {
+    if(proc_fd < 0 && start_proc() < 0) {
+        out_printf("Proc connector not available (%s), forks and execs are not tracked\n", strerror(errno));
+    }
+    if(stats_fd < 0 && start_stats() < 0) {
+        out_printf("Taskstats not available (%s), exited jobs have no accounting\n", strerror(errno));
+    }
+    if(proc_fd < 0 && stats_fd < 0) {
+        out_printf("Kernel events not available, pman keeps using waitpid and /proc\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Unsubscribe and forget tracked descendants, traces of jobs are kept */
+void events_stop(void) {
+    if(proc_fd >= 0) {
+        proc_request(PROC_CN_MCAST_IGNORE); //the kernel counts listeners
+        evloop_remove(events_loop, proc_fd);
+        close(proc_fd);
+        proc_fd = -1;
+    }
+    if(stats_fd >= 0) {
+        stats_request(TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK, 0);
+        evloop_remove(events_loop, stats_fd);
+        close(stats_fd);
+        stats_fd = -1;
+    }
+
+    while(descendants.num) {
+        ADThashnode * node = adtPopHashNode(&descendants, descendants.head->key);
+        xfree(node->val);
+    }
+    adtFreeHashTable(&descendants);
+
+    ADThashtable * tables[] = {&events_jobs->active, &events_jobs->exited};
+    int i;
+    for(i = 0; i < 2; i++) { //nothing counts descendants down any more
+        ADThashnode * node;
+        for(node = tables[i]->head; node; node = node->next) {
+            subprogram * job = (subprogram *) node->val;
+            if(job->trace) job->trace->descendants = 0;
+        }
+    }
+}
+
+/* Handle every message already queued, so exit accounting of reaped jobs is in */
+void events_drain(void) {
+    if(proc_fd >= 0) on_proc(proc_fd, EPOLLIN, NULL);
+    if(stats_fd >= 0) on_stats(stats_fd, EPOLLIN, NULL);
+}
+
+/* Summary: Runs the events command
+ * Description: on subscribes, off unsubscribes, both then print the
+ * state like events alone: the sources in use, messages handled, times
+ * messages were lost and descendants being tracked
+ * Takes:
+ *       args: arguements after events
+ * Returns: -1 on failure, 0 otherwise
+ */
+int events_command(char * * args) {
+    if(args[0] && (args[1] || (strcmp(args[0], "on") != 0 && strcmp(args[0], "off") != 0))) {
+        out_printf("Invalid arguements\nusage: events [on|off]\n");
+        return -1;
+    }
+
+    int ret = 0;
+    if(args[0] && strcmp(args[0], "on") == 0) ret = events_start();
+    else if(args[0]) events_stop();
+
+    int on = proc_fd >= 0 || stats_fd >= 0;
+    if(out_get_format() != OUT_HUMAN) {
+        out_record("events");
+        out_field_str("state", on ? "on" : "off");
+        out_field_int("proc_connector", proc_fd >= 0);
+        out_field_int("taskstats", stats_fd >= 0);
+        out_field_int("messages", messages);
+        out_field_int("lost", lost);
+        out_field_int("descendants", descendants.num);
+        out_end_record();
+        return ret;
+    }
+    out_printf("Events: %s (proc connector %s, taskstats %s)\n"
+               "Messages: %lu, lost %lu times\n"
+               "Descendants tracked: %d\n",
+               on ? "on" : "off", proc_fd >= 0 ? "yes" : "no", stats_fd >= 0 ? "yes" : "no",
+               messages, lost, descendants.num);
+    return ret;
+}
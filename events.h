@@ -0,0 +1,49 @@
+/* Kernel event feed header. "events on" subscribes to the proc connector
+ * (fork, exec and exit of every process) and registers for taskstats
+ * exit accounting over netlink. Messages are matched to jobs and their
+ * descendants by pid as they arrive, so nothing is polled. Both families
+ * need CAP_NET_ADMIN, without them pman works from waitpid and /proc */
+
+#ifndef _EVENTS_H
+#define _EVENTS_H
+
+#include "evloop.h"
+#include "jobs.h"
+
+/* Struct for what the kernel reported about one job */
+typedef struct job_trace {
+    int forks; //processes started by the job or its descendants
+    int execs; //the job's own exec included
+    int descendants; //still running
+    int accounted; //the taskstats fields below are set, the job exited
+    int whole; //cpu fields are thread group totals, not the main thread
+    unsigned long long utime_us;
+    unsigned long long stime_us;
+    unsigned long long cpu_delay_ns; //waiting for a cpu
+    unsigned long long blkio_delay_ns; //waiting for block io
+    unsigned long long read_bytes; //storage io
+    unsigned long long write_bytes;
+    unsigned long long max_rss_kb;
+    unsigned long long nvcsw;
+    unsigned long long nivcsw;
+} job_trace;
+
+/* Match events against jobs, dispatched from loop. Must be called before events_start */
+void events_init(evloop * loop, jobtable * jobs);
+
+/* Subscribe to the proc connector and taskstats, an unavailable one is
+ * reported and skipped
+ * Returns: -1 if neither could be opened, 0 otherwise */
+int events_start(void);
+
+/* Unsubscribe and forget tracked descendants, traces of jobs are kept */
+void events_stop(void);
+
+/* Handle every message already queued, so exit accounting of reaped jobs is in */
+void events_drain(void);
+
+/* Runs the events command, args after events: nothing, on or off
+ * Returns: -1 on failure, 0 otherwise */
+int events_command(char * * args);
+
+#endif
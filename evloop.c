@@ -0,0 +1,128 @@
+/* Event loop implementation code */
+
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "evloop.h"
+#include "utils.h"
+
+#define EVLOOP_MAX_EVENTS 64
+
+/* Initiate the loop. Returns -1 on failure. 0 otherwise */
+int evloop_init(evloop * loop) {
+    loop->num = 0;
+    loop->removed = NULL;
+    loop->handlers = NULL;
+    loop->handlers_size = 0;
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(loop->epfd < 0) return -1;
+    return 0;
+}
+
+/* Free handlers removed during the last dispatch round */
+static void free_removed(evloop * loop) {
+    while(loop->removed) {
+        evhandler * handler = loop->removed;
+        loop->removed = handler->next;
+        xfree(handler);
+    }
+}
+
+/* Close the loop and free all handlers. Registered fds are not closed */
+void evloop_close(evloop * loop) {
+    int fd;
+    for(fd = 0; fd < loop->handlers_size; fd++) {
+        if(loop->handlers[fd]) evloop_remove(loop, fd);
+    }
+    free_removed(loop);
+    if(loop->handlers) xfree(loop->handlers);
+    loop->handlers = NULL;
+    loop->handlers_size = 0;
+    if(loop->epfd >= 0) close(loop->epfd);
+    loop->epfd = -1;
+}
+
+/* Register a callback for events on fd. Returns -1 on failure (errno set). 0 otherwise */
+int evloop_add(evloop * loop, int fd, unsigned int events, evloop_callback callback, void * data) {
+    assert(fd >= 0);
+    if(fd >= loop->handlers_size) {
+        int size = loop->handlers_size ? loop->handlers_size : 64;
+        while(size <= fd) size *= 2;
+        loop->handlers = loop->handlers ? xrealloc(loop->handlers, sizeof(evhandler *) * size)
+                                        : xmalloc(sizeof(evhandler *) * size);
+        int i;
+        for(i = loop->handlers_size; i < size; i++) loop->handlers[i] = NULL;
+        loop->handlers_size = size;
+    }
+    if(loop->handlers[fd]) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    evhandler * handler = xmalloc(sizeof(evhandler));
+    handler->fd = fd;
+    handler->callback = callback;
+    handler->data = data;
+    handler->next = NULL;
+
+    struct epoll_event event = {0};
+    event.events = events;
+    event.data.ptr = handler;
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        int err = errno;
+        xfree(handler);
+        errno = err;
+        return -1;
+    }
+
+    loop->handlers[fd] = handler;
+    loop->num++;
+    return 0;
+}
+
+/* Change the events watched for fd. Returns -1 on failure. 0 otherwise */
+int evloop_modify(evloop * loop, int fd, unsigned int events) {
+    if(fd < 0 || fd >= loop->handlers_size || !loop->handlers[fd]) return -1;
+    struct epoll_event event = {0};
+    event.events = events;
+    event.data.ptr = loop->handlers[fd];
+    return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &event);
+}
+
+/* Unregister fd, safe to call from inside a callback. Returns -1 if fd is unknown. 0 otherwise */
+int evloop_remove(evloop * loop, int fd) {
+    if(fd < 0 || fd >= loop->handlers_size || !loop->handlers[fd]) return -1;
+    evhandler * handler = loop->handlers[fd];
+    loop->handlers[fd] = NULL;
+
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL); //fails harmlessly if fd was already closed
+    handler->fd = -1; //events already fetched for it are skipped
+    handler->next = loop->removed;
+    loop->removed = handler;
+    loop->num--;
+    return 0;
+}
+
+/* Wait up to timeout ms (-1 forever) and dispatch all ready fds.
+ * Returns number of events dispatched, -1 on failure */
+int evloop_run_once(evloop * loop, int timeout) {
+    struct epoll_event events[EVLOOP_MAX_EVENTS];
+    int ready = epoll_wait(loop->epfd, events, EVLOOP_MAX_EVENTS, timeout);
+    if(ready < 0) {
+        if(errno == EINTR) return 0;
+        return -1;
+    }
+
+    int i;
+    for(i = 0; i < ready; i++) {
+        evhandler * handler = events[i].data.ptr;
+        if(handler->fd < 0) continue; //removed by an earlier callback
+        handler->callback(handler->fd, events[i].events, handler->data);
+    }
+
+    free_removed(loop);
+    return ready;
+}
@@ -0,0 +1,45 @@
+/* Event loop header, a thin epoll wrapper dispatching ready fds to callbacks */
+
+#ifndef _EVLOOP_H
+#define _EVLOOP_H
+
+#include <sys/epoll.h>
+
+/* Called with the ready fd, the epoll event mask and the data given at registration */
+typedef void (*evloop_callback)(int fd, unsigned int events, void * data);
+
+typedef struct evhandler{
+    int fd; //-1 once removed
+    evloop_callback callback;
+    void * data;
+    struct evhandler * next; //handlers waiting to be freed
+} evhandler;
+
+typedef struct evloop{
+    int epfd;
+    int num; //number of registered fds
+    struct evhandler * * handlers; //indexed by fd
+    int handlers_size;
+    struct evhandler * removed; //freed after the current dispatch round
+} evloop;
+
+/* Initiate the loop. Returns -1 on failure. 0 otherwise */
+int evloop_init(evloop * loop);
+
+/* Close the loop and free all handlers. Registered fds are not closed */
+void evloop_close(evloop * loop);
+
+/* Register a callback for events on fd. Returns -1 on failure (errno set). 0 otherwise */
+int evloop_add(evloop * loop, int fd, unsigned int events, evloop_callback callback, void * data);
+
+/* Change the events watched for fd. Returns -1 on failure. 0 otherwise */
+int evloop_modify(evloop * loop, int fd, unsigned int events);
+
+/* Unregister fd, safe to call from inside a callback. Returns -1 if fd is unknown. 0 otherwise */
+int evloop_remove(evloop * loop, int fd);
+
+/* Wait up to timeout ms (-1 forever) and dispatch all ready fds.
+ * Returns number of events dispatched, -1 on failure */
+int evloop_run_once(evloop * loop, int timeout);
+
+#endif
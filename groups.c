@@ -0,0 +1,211 @@
+/* Job groups implementation code */
+
+#define MEM_TAG MEM_JOBS
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "groups.h"
+#include "utils.h"
+
+static jobgroup * groups = NULL;
+static int cgroup_base_fd = -2; //pman's own cgroup v2 directory, -2 before the first lookup, -1 if unusable
+
+/* Copies the mount point of the cgroup v2 hierarchy into path
+ * Returns: -1 if there is none, 0 otherwise */
+static int cgroup2_mount(char * path, int size) {
+    FILE * fp = fopen("/proc/self/mountinfo", "r");
+    if(!fp) return -1;
+
+    char * line = NULL;
+    size_t line_size = 0;
+    int ret = -1;
+    while(ret < 0 && getline(&line, &line_size, fp) > 0) {
+        char * fields = strstr(line, " - cgroup2 "); //optional fields end with " - "
+        if(!fields) continue;
+        char mount[4096];
+        if(sscanf(line, "%*s %*s %*s %*s %4095s", mount) == 1 && (int) strlen(mount) < size) {
+            strcpy(path, mount);
+            ret = 0;
+        }
+    }
+    free(line); //allocated by getline
+    fclose(fp);
+    return ret;
+}
+
+/* Opens the cgroup v2 directory pman runs in, if pman may create groups in it
+ * Returns: the directory, -1 if it is not available */
+static int cgroup_base(void) {
+    if(cgroup_base_fd != -2) return cgroup_base_fd;
+    cgroup_base_fd = -1;
+
+    char path[8192];
+    if(cgroup2_mount(path, 4096) < 0) return -1;
+
+    FILE * fp = fopen("/proc/self/cgroup", "r");
+    if(!fp) return -1;
+    char * line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    while((len = getline(&line, &line_size, fp)) > 0) {
+        if(strncmp(line, "0::", 3) != 0) continue; //the v2 entry
+        if(line[len - 1] == '\n') line[len - 1] = 0;
+        if(strlen(path) + strlen(line + 3) < sizeof(path)) strcat(path, line + 3);
+        break;
+    }
+    free(line); //allocated by getline
+    fclose(fp);
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) return -1;
+    //moving children needs write access to cgroup.procs of the common parent
+    if(faccessat(fd, "cgroup.procs", W_OK, 0) < 0 || faccessat(fd, ".", W_OK, 0) < 0) {
+        close(fd);
+        return -1;
+    }
+    cgroup_base_fd = fd;
+    return fd;
+}
+
+/* Directory name of the cgroup of a group */
+static void cgroup_name(jobgroup * group, char * dir, int size) {
+    snprintf(dir, size, "pman.%d.%s", (int) getpid(), group->name);
+}
+
+/* Creates the cgroup of a group, leaves the fds at -1 if it can not */
+static void cgroup_create(jobgroup * group) {
+    int base = cgroup_base();
+    if(base < 0) return;
+
+    char dir[GROUP_NAME_SIZE + 32];
+    cgroup_name(group, dir, sizeof(dir));
+    if(mkdirat(base, dir, 0755) < 0 && errno != EEXIST) return;
+
+    group->cgroup_fd = openat(base, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(group->cgroup_fd < 0) return;
+    group->procs_fd = openat(group->cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    if(group->procs_fd < 0) {
+        close(group->cgroup_fd);
+        group->cgroup_fd = -1;
+        unlinkat(base, dir, AT_REMOVEDIR);
+    }
+}
+
+/* Writes value to a control file of the cgroup of a group
+ * Returns: -1 on failure and sets errno, 0 otherwise */
+int group_cgroup_write(jobgroup * group, const char * file, const char * value) {
+    int fd = openat(group->cgroup_fd, file, O_WRONLY | O_CLOEXEC);
+    if(fd < 0) return -1;
+    int ret = write(fd, value, strlen(value)) < 0 ? -1 : 0;
+    int err = errno;
+    close(fd);
+    errno = err;
+    return ret;
+}
+
+/* Summary: Finds a group by name
+ * Takes:
+ *        name: name of the group, letters, digits, '_', '-' and '.'
+ *        create: add the group if it does not exist
+ * Returns: the group, NULL if it does not exist or the name is invalid */
+jobgroup * group_find(const char * name, int create) {
+    jobgroup * group;
+    for(group = groups; group; group = group->next) {
+        if(strcmp(group->name, name) == 0) return group;
+    }
+    if(!create) return NULL;
+
+    int len = strlen(name);
+    if(len == 0 || len >= GROUP_NAME_SIZE || strspn(name, "abcdefghijklmnopqrstuvwxyz"
+       "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-.") != (size_t) len || name[0] == '.') {
+        return NULL;
+    }
+
+    group = xmalloc(sizeof(jobgroup));
+    strcpy(group->name, name);
+    group->pgid = 0;
+    group->members = 0;
+    group->cgroup_fd = -1;
+    group->procs_fd = -1;
+    cgroup_create(group);
+    group->next = groups;
+    groups = group;
+    return group;
+}
+
+/* Counts a started job as a member, its pid leads the group if it is the first */
+void group_join(jobgroup * group, pid_t pid) {
+    if(group->pgid == 0) group->pgid = pid;
+    group->members++;
+}
+
+/* Counts a reaped job out of the group, an empty group gets a new leader */
+void group_leave(jobgroup * group) {
+    if(--group->members == 0) group->pgid = 0; //the process group may be gone
+}
+
+/* Sends signal to every process of the group with one killpg
+ * Returns: -1 on failure and sets errno, 0 otherwise */
+int group_signal(jobgroup * group, int signal) {
+    if(group->pgid == 0) {
+        errno = ESRCH;
+        return -1;
+    }
+    return killpg(group->pgid, signal);
+}
+
+/* Kills the group, with cgroup.kill when it has a cgroup so processes
+ * that left the process group die too, otherwise with killpg
+ * via, unless NULL, is set to the mechanism used
+ * Returns: -1 on failure and sets errno, 0 otherwise */
+int group_kill(jobgroup * group, const char * * via) {
+    const char * used = "cgroup.kill";
+    int ret = 0;
+    if(group->cgroup_fd < 0 || group_cgroup_write(group, used, "1") < 0) {
+        used = "killpg"; //no cgroup, or cgroup.kill is missing before Linux 5.14
+        ret = group_signal(group, SIGKILL);
+    }
+    if(via) *via = used;
+    return ret;
+}
+
+/* Freezes (frozen 1) or thaws (frozen 0) the group, with cgroup.freeze
+ * when it has a cgroup, otherwise with SIGSTOP or SIGCONT to the process group
+ * via, unless NULL, is set to the mechanism used
+ * Returns: -1 on failure and sets errno, 0 otherwise */
+int group_freeze(jobgroup * group, int frozen, const char * * via) {
+    const char * used = "cgroup.freeze";
+    int ret = 0;
+    if(group->cgroup_fd < 0 || group_cgroup_write(group, used, frozen ? "1" : "0") < 0) {
+        used = "killpg";
+        ret = group_signal(group, frozen ? SIGSTOP : SIGCONT);
+    }
+    if(via) *via = used;
+    return ret;
+}
+
+/* Frees all groups, their cgroups are removed if they are empty */
+void group_free_all(void) {
+    while(groups) {
+        jobgroup * group = groups;
+        groups = group->next;
+        if(group->cgroup_fd >= 0) {
+            char dir[GROUP_NAME_SIZE + 32];
+            cgroup_name(group, dir, sizeof(dir));
+            close(group->procs_fd);
+            close(group->cgroup_fd);
+            unlinkat(cgroup_base_fd, dir, AT_REMOVEDIR); //fails while jobs still run in it
+        }
+        xfree(group);
+    }
+    if(cgroup_base_fd >= 0) close(cgroup_base_fd);
+    cgroup_base_fd = -2;
+}
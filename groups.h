@@ -0,0 +1,58 @@
+/* Job groups header. A named group is one process group, and also a
+ * cgroup v2 directory when pman may create one, so the whole group
+ * (grandchildren included) is signalled, killed or frozen at once */
+
+#ifndef _GROUPS_H
+#define _GROUPS_H
+
+#include <sys/types.h>
+
+#define GROUP_NAME_SIZE 64
+
+/* Struct for a named group of jobs */
+typedef struct jobgroup {
+    struct jobgroup * next;
+    pid_t pgid; //process group of the members, 0 until a job leads it
+    int members; //active jobs in the group
+    int cgroup_fd; //cgroup directory, -1 without one
+    int procs_fd; //cgroup.procs of the directory, written by each child
+    char name[GROUP_NAME_SIZE];
+} jobgroup;
+
+/* Summary: Finds a group by name
+ * Takes:
+ *        name: name of the group, letters, digits, '_', '-' and '.'
+ *        create: add the group if it does not exist
+ * Returns: the group, NULL if it does not exist or the name is invalid */
+jobgroup * group_find(const char * name, int create);
+
+/* Counts a started job as a member, its pid leads the group if it is the first */
+void group_join(jobgroup * group, pid_t pid);
+
+/* Counts a reaped job out of the group, an empty group gets a new leader */
+void group_leave(jobgroup * group);
+
+/* Sends signal to every process of the group with one killpg
+ * Returns: -1 on failure and sets errno, 0 otherwise */
+int group_signal(jobgroup * group, int signal);
+
+/* Kills the group, with cgroup.kill when it has a cgroup so processes
+ * that left the process group die too, otherwise with killpg
+ * via, unless NULL, is set to the mechanism used
+ * Returns: -1 on failure and sets errno, 0 otherwise */
+int group_kill(jobgroup * group, const char * * via);
+
+/* Freezes (frozen 1) or thaws (frozen 0) the group, with cgroup.freeze
+ * when it has a cgroup, otherwise with SIGSTOP or SIGCONT to the process group
+ * via, unless NULL, is set to the mechanism used
+ * Returns: -1 on failure and sets errno, 0 otherwise */
+int group_freeze(jobgroup * group, int frozen, const char * * via);
+
+/* Writes value to a control file of the cgroup of a group, which must have one
+ * Returns: -1 on failure and sets errno, 0 otherwise */
+int group_cgroup_write(jobgroup * group, const char * file, const char * value);
+
+/* Frees all groups, their cgroups are removed if they are empty */
+void group_free_all(void);
+
+#endif
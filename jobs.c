@@ -0,0 +1,206 @@
+/* Job record implementation code */
+
+#define MEM_TAG MEM_JOBS
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/syscall.h>
+
+#include "ADTpool.h"
+#include "capture.h"
+#include "jobs.h"
+#include "perf.h"
+#include "utils.h"
+
+#define JOB_SLAB 256 //records per slab
+#define INTERN_BUCKETS 256
+
+#ifndef SYS_pidfd_open //older headers, numbers are shared by all architectures
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+
+/* Struct for an interned name, shared by every job with that name */
+typedef struct interned_name {
+    struct interned_name * next; //bucket chain
+    unsigned int hash;
+    int refs;
+    char name[]; //null terminated
+} interned_name;
+
+static ADTpool pool;
+static int pool_ready = 0;
+static interned_name * intern_buckets[INTERN_BUCKETS];
+static int interned = 0;
+static int interned_refs = 0;
+
+/* FNV-1a hash of a string */
+static unsigned int hash_name(const char * name) {
+    unsigned int hash = 2166136261u;
+    for(; *name; name++) hash = (hash ^ (unsigned char) *name) * 16777619u;
+    return hash;
+}
+
+/* Get the shared copy of name, adding it on first use */
+static const char * intern(const char * name) {
+    unsigned int hash = hash_name(name);
+    interned_name * entry = intern_buckets[hash % INTERN_BUCKETS];
+    while(entry && (entry->hash != hash || strcmp(entry->name, name) != 0)) entry = entry->next;
+
+    if(!entry) {
+        entry = xmalloc(sizeof(interned_name) + strlen(name) + 1);
+        entry->hash = hash;
+        entry->refs = 0;
+        strcpy(entry->name, name);
+        entry->next = intern_buckets[hash % INTERN_BUCKETS];
+        intern_buckets[hash % INTERN_BUCKETS] = entry;
+        interned++;
+    }
+    entry->refs++;
+    interned_refs++;
+    return entry->name;
+}
+
+/* Drop a reference to an interned name, freeing it with the last one */
+static void release(const char * name) {
+    unsigned int hash = hash_name(name);
+    interned_name * * link = &intern_buckets[hash % INTERN_BUCKETS];
+    while(*link && (*link)->name != name) link = &(*link)->next;
+    assert(*link);
+
+    interned_name * entry = *link;
+    interned_refs--;
+    if(--entry->refs == 0) {
+        *link = entry->next;
+        xfree(entry);
+        interned--;
+    }
+}
+
+/* Take a record from the pool for pid named name, its node is keyed by pid. O(1)
+ * Aborts program on failure */
+subprogram * job_alloc(pid_t pid, const char * name) {
+    if(!pool_ready) {
+        adtInitiatePool(&pool, sizeof(subprogram), JOB_SLAB);
+        pool_ready = 1;
+    }
+
+    subprogram * job = adtPoolAlloc(&pool);
+    adtInitiateHashNode(&job->node, pid, job);
+    job->pid = pid;
+    job->status = 0;
+    job->pidfd = -1;
+    job->group = NULL;
+    job->queued = 0;
+    job->capture = NULL;
+    job->perf = NULL;
+    job->spread_cpu = -1;
+    job->spread_node = -1;
+    job->trace = NULL;
+    job->watch = NULL;
+    job->sample.time = 0;
+
+    if(strlen(name) < JOB_INLINE_NAME) {
+        strcpy(job->inline_name, name);
+        job->name = job->inline_name;
+    } else {
+        job->name = intern(name);
+    }
+    return job;
+}
+
+/* Return a record to the pool, it must not be in a table. O(1) */
+void job_free(subprogram * job) {
+    job_close_pidfd(job);
+    if(job->capture) capture_free(job->capture);
+    if(job->perf) perf_close(job->perf);
+    if(job->trace) xfree(job->trace);
+    if(job->watch) xfree(job->watch);
+    if(job->name != job->inline_name) release(job->name);
+    adtPoolFree(&pool, job);
+}
+
+/* Open a pidfd for the job, it refers to this process even once the pid
+ * is reused. Left at -1 on kernels without pidfd_open */
+void job_open_pidfd(subprogram * job) {
+    static int supported = 1;
+    if(!supported) return;
+
+    //pman is the parent and the only reaper, so the pid still names the job
+    job->pidfd = syscall(SYS_pidfd_open, job->pid, 0); //always close on exec
+    if(job->pidfd < 0) {
+        if(errno == ENOSYS) supported = 0;
+        else if(errno != ESRCH) perror("Warning. Opening a pidfd failed, using kill for the job");
+        job->pidfd = -1;
+    }
+}
+
+/* Close the pidfd of the job, called when it is reaped */
+void job_close_pidfd(subprogram * job) {
+    if(job->pidfd < 0) return;
+    close(job->pidfd);
+    job->pidfd = -1;
+}
+
+/* Send signal to the job through its pidfd, with kill when it has none
+ * Returns: -1 on failure and sets errno, 0 otherwise */
+int job_signal(subprogram * job, int signal) {
+    if(job->pidfd < 0) return kill(job->pid, signal); //only the unreaped zombie keeps the pid from reuse
+    return syscall(SYS_pidfd_send_signal, job->pidfd, signal, NULL, 0);
+}
+
+/* Summary: Checks which jobs have exited with one poll of their pidfds
+ * Takes:
+ *        jobs: jobs to check
+ *        num: number of jobs
+ * Returns: number of jobs that exited or have no pidfd to check, so a
+ * reap is needed before trusting their state */
+int job_poll_exited(subprogram * * jobs, int num) {
+    if(num == 0) return 0;
+    struct pollfd * fds = xmalloc(sizeof(struct pollfd) * num);
+    int unknown = 0;
+    int i;
+    for(i = 0; i < num; i++) {
+        fds[i].fd = jobs[i]->pidfd; //poll ignores negative fds
+        fds[i].events = POLLIN; //readable once the process exits
+        fds[i].revents = 0;
+        if(fds[i].fd < 0) unknown++;
+    }
+
+    int exited = poll(fds, num, 0);
+    xfree(fds);
+    if(exited < 0) return num; //treat all as unknown, the caller reaps
+    return exited + unknown;
+}
+
+/* Fill stats with the current occupancy of the pool */
+void job_get_pool_stats(job_pool_stats * stats) {
+    stats->used = pool_ready ? pool.used : 0;
+    stats->capacity = pool_ready ? pool.capacity : 0;
+    stats->slabs = pool_ready ? pool.slabs : 0;
+    stats->interned = interned;
+    stats->interned_refs = interned_refs;
+}
+
+/* Free the pool and interned names, all records must have been freed */
+void job_free_pool(void) {
+    if(pool_ready) adtFreePool(&pool);
+    int i;
+    for(i = 0; i < INTERN_BUCKETS; i++) {
+        while(intern_buckets[i]) {
+            interned_name * entry = intern_buckets[i];
+            intern_buckets[i] = entry->next;
+            xfree(entry);
+        }
+    }
+    interned = 0;
+    interned_refs = 0;
+}
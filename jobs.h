@@ -0,0 +1,94 @@
+/* Job records. Each background job is one fixed size record from a slab
+ * pool with its table node inside it. Short names are stored in the
+ * record, longer ones are interned and shared between jobs */
+
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <sys/types.h>
+
+#include "ADThashtable.h"
+
+struct jobgroup;
+struct capture;
+struct perf_group;
+struct job_trace;
+struct job_watch;
+
+#define JOB_INLINE_NAME 32 //names shorter than this live inside the record
+
+/* Struct for the last stats sample of a program, used for rates by ptop */
+typedef struct job_sample {
+    double time; //monotonic seconds, 0 before the first sample
+    unsigned long cpu; //utime + stime in clock ticks
+    long rss; //pages
+    long ctxt; //voluntary + nonvoluntary context switches
+} job_sample;
+
+/* Struct for background programs */
+typedef struct subprogram {
+    ADThashnode node; //node.val points back to the program
+    const char * name; //inline_name or an interned string
+    pid_t pid;
+    int status; //wait status, only valid once reaped
+    int pidfd; //-1 once reaped or when pidfds are not supported
+    struct jobgroup * group; //NULL when not started in a group
+    int queued; //started by bgqueue, counted as running there until reaped
+    struct capture * capture; //NULL when the output is not captured, kept until bglist reports the job
+    struct perf_group * perf; //NULL without counters, kept like capture
+    int spread_cpu; //cpu claimed by --spread cpu until reaped, -1 for none
+    int spread_node; //node claimed by --spread node, -1 for none
+    struct job_trace * trace; //kernel events and exit accounting, NULL until events on reports one
+    struct job_watch * watch; //limits and last sample of the watchdog, NULL until it watches the job
+    job_sample sample;
+    char inline_name[JOB_INLINE_NAME];
+} subprogram;
+
+/* Struct for all jobs pman knows about */
+typedef struct jobtable {
+    ADThashtable active; //running or stopped jobs
+    ADThashtable exited; //reaped jobs not yet reported by bglist
+} jobtable;
+
+/* Struct for the occupancy of the job pool */
+typedef struct job_pool_stats {
+    int used; //records handed out
+    int capacity; //records in all slabs
+    int slabs;
+    int interned; //distinct long names
+    int interned_refs; //jobs using an interned name
+} job_pool_stats;
+
+/* Take a record from the pool for pid named name, its node is keyed by pid. O(1)
+ * Aborts program on failure */
+subprogram * job_alloc(pid_t pid, const char * name);
+
+/* Return a record to the pool, it must not be in a table. O(1) */
+void job_free(subprogram * job);
+
+/* Open a pidfd for the job, it refers to this process even once the pid
+ * is reused. Left at -1 on kernels without pidfd_open */
+void job_open_pidfd(subprogram * job);
+
+/* Close the pidfd of the job, called when it is reaped */
+void job_close_pidfd(subprogram * job);
+
+/* Send signal to the job through its pidfd, with kill when it has none
+ * Returns: -1 on failure and sets errno, 0 otherwise */
+int job_signal(subprogram * job, int signal);
+
+/* Summary: Checks which jobs have exited with one poll of their pidfds
+ * Takes:
+ *        jobs: jobs to check
+ *        num: number of jobs
+ * Returns: number of jobs that exited or have no pidfd to check, so a
+ * reap is needed before trusting their state */
+int job_poll_exited(subprogram * * jobs, int num);
+
+/* Fill stats with the current occupancy of the pool */
+void job_get_pool_stats(job_pool_stats * stats);
+
+/* Free the pool and interned names, all records must have been freed */
+void job_free_pool(void);
+
+#endif
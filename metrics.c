@@ -0,0 +1,147 @@
+/* Self instrumentation implementation code */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "output.h"
+
+#define METRICS_NAME_SIZE 16
+
+static histogram phases[PHASE_COUNT];
+static const char * phase_names[PHASE_COUNT] = {"fork", "exec-confirm", "insert", "lookup",
+                                                "proc-read", "parse", "reap"};
+
+/* Commands are kept by name in the order first seen */
+static histogram commands[METRICS_COMMANDS];
+static char command_names[METRICS_COMMANDS][METRICS_NAME_SIZE];
+static int num_commands = 0;
+
+/* Monotonic time in nanoseconds, the start of a sample */
+unsigned long long metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Bucket of a value, values under 4 have their own bucket, then each
+ * power of two is split in four by the two bits after the leading one */
+static int bucket_of(unsigned long long value) {
+    if(value < 4) return value;
+    int exponent = 63 - __builtin_clzll(value);
+    return (exponent - 1) * 4 + ((value >> (exponent - 2)) & 3);
+}
+
+/* Largest value that falls in a bucket */
+static unsigned long long bucket_top(int bucket) {
+    if(bucket < 4) return bucket;
+    int exponent = bucket / 4 + 1;
+    unsigned long long low = (4ULL + bucket % 4) << (exponent - 2);
+    return low + (1ULL << (exponent - 2)) - 1;
+}
+
+/* Record the time since start in a histogram, thread safe */
+void histogram_record(histogram * hist, unsigned long long start) {
+    unsigned long long value = metrics_now() - start;
+    __atomic_fetch_add(&hist->buckets[bucket_of(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+
+    unsigned long long max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while(value > max && !__atomic_compare_exchange_n(&hist->max, &max, value, 1,
+                                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* Value at quantile q (0 to 1) of a histogram, the upper edge of its
+ * bucket so at most 25% over. 0 when empty */
+unsigned long long histogram_quantile(const histogram * hist, double q) {
+    if(!hist->count) return 0;
+    unsigned long long rank = q * hist->count;
+    if(rank >= hist->count) rank = hist->count - 1;
+
+    unsigned long long seen = 0;
+    int i;
+    for(i = 0; i < METRICS_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if(seen > rank) break;
+    }
+    unsigned long long top = bucket_top(i < METRICS_BUCKETS ? i : METRICS_BUCKETS - 1);
+    return top < hist->max ? top : hist->max;
+}
+
+/* Record the time since start for a phase, thread safe */
+void metrics_phase_record(metrics_phase phase, unsigned long long start) {
+    histogram_record(&phases[phase], start);
+}
+
+/* Record the time since start for a command by name, main thread only */
+void metrics_command_record(const char * name, unsigned long long start) {
+    int i;
+    for(i = 0; i < num_commands; i++) {
+        if(strcmp(command_names[i], name) == 0) break;
+    }
+    if(i == METRICS_COMMANDS) { //full, the last slot has the rest
+        i = METRICS_COMMANDS - 1;
+    } else if(i == num_commands) {
+        snprintf(command_names[i], METRICS_NAME_SIZE, "%s", i == METRICS_COMMANDS - 1 ? "other" : name);
+        num_commands++;
+    }
+    histogram_record(&commands[i], start);
+}
+
+/* Clear every histogram */
+void metrics_reset(void) {
+    memset(phases, 0, sizeof(phases));
+    memset(commands, 0, sizeof(commands));
+    num_commands = 0;
+}
+
+/* Prints one histogram as a row, times in microseconds */
+static void print_histogram(const char * kind, const char * name, const histogram * hist) {
+    double p50 = histogram_quantile(hist, 0.5) / 1e3;
+    double p99 = histogram_quantile(hist, 0.99) / 1e3;
+    double max = hist->max / 1e3;
+    if(out_get_format() != OUT_HUMAN) {
+        out_record("pmanstat");
+        out_field_str("kind", kind);
+        out_field_str("name", name);
+        out_field_int("count", hist->count);
+        out_field_double("p50_us", p50);
+        out_field_double("p99_us", p99);
+        out_field_double("max_us", max);
+        out_end_record();
+        return;
+    }
+    out_printf("%-8s %-13s %10llu %10.1f %10.1f %10.1f\n", kind, name, hist->count, p50, p99, max);
+}
+
+/* Summary: Runs the pmanstat command
+ * Description: Prints count, p50, p99 and max of every phase and of
+ * every command run so far, with reset clears them after printing.
+ * pmanstat itself is timed after it printed
+ * Takes:
+ *       args: arguements after pmanstat
+ * Returns: -1 on failure, 0 otherwise
+ */
+int metrics_command(char * * args) {
+    int reset = 0;
+    if(args[0] && (args[1] || !(reset = strcmp(args[0], "reset") == 0))) {
+        out_printf("Invalid arguements\nusage: pmanstat [reset]\n");
+        return -1;
+    }
+
+    if(out_get_format() == OUT_HUMAN) {
+        out_printf("%-8s %-13s %10s %10s %10s %10s\n", "Kind", "Name", "Count", "p50 us", "p99 us", "Max us");
+    }
+    int i;
+    for(i = 0; i < PHASE_COUNT; i++) {
+        if(phases[i].count) print_histogram("phase", phase_names[i], &phases[i]);
+    }
+    for(i = 0; i < num_commands; i++) print_histogram("command", command_names[i], &commands[i]);
+
+    if(reset) {
+        metrics_reset();
+        out_printf("Histograms reset\n");
+    }
+    return 0;
+}
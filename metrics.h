@@ -0,0 +1,53 @@
+/* Self instrumentation header. Commands and the phases inside them are
+ * timed on the monotonic clock into log bucketed histograms, four
+ * buckets per power of two, so a sample costs two clock reads and a few
+ * adds. Phases may be timed on the /proc worker threads too */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#define METRICS_BUCKETS 256 //covers every 64 bit nanosecond value
+#define METRICS_COMMANDS 32 //distinct command names timed, later ones count as other
+
+typedef enum metrics_phase {
+    PHASE_FORK,         //fork, vfork or posix_spawn until it returns to pman
+    PHASE_EXEC_CONFIRM, //reading the exec result of a fork child
+    PHASE_INSERT,       //adding a started job to the table
+    PHASE_LOOKUP,       //resolving pids and selectors to jobs
+    PHASE_PROC_READ,    //open, read and close of /proc/pid files
+    PHASE_PARSE,        //parsing /proc/pid/stat and status
+    PHASE_REAP,         //reap_children calls that reaped jobs
+    PHASE_COUNT
+} metrics_phase;
+
+/* Struct for one histogram of durations in nanoseconds */
+typedef struct histogram {
+    unsigned long long count;
+    unsigned long long max;
+    unsigned long long buckets[METRICS_BUCKETS];
+} histogram;
+
+/* Monotonic time in nanoseconds, the start of a sample */
+unsigned long long metrics_now(void);
+
+/* Record the time since start in a histogram, thread safe */
+void histogram_record(histogram * hist, unsigned long long start);
+
+/* Value at quantile q (0 to 1) of a histogram, the upper edge of its
+ * bucket so at most 25% over. 0 when empty */
+unsigned long long histogram_quantile(const histogram * hist, double q);
+
+/* Record the time since start for a phase, thread safe */
+void metrics_phase_record(metrics_phase phase, unsigned long long start);
+
+/* Record the time since start for a command by name, main thread only */
+void metrics_command_record(const char * name, unsigned long long start);
+
+/* Clear every histogram */
+void metrics_reset(void);
+
+/* Runs the pmanstat command with the arguements after pmanstat
+ * Returns: -1 on failure, 0 otherwise */
+int metrics_command(char * * args);
+
+#endif
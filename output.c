@@ -0,0 +1,256 @@
+/* Command output implementation code */
+
+#define MEM_TAG MEM_OUTPUT
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "utils.h"
+
+static outbuf * capture = NULL; //NULL prints to stdout
+static outbuf stdout_buf = {NULL, 0, 0}; //output for stdout, reused by every command
+static outbuf pending = {NULL, 0, 0}; //text of an unfinished line in json and tsv
+static out_format current_format = OUT_HUMAN;
+
+/* Initiate an empty buffer, nothing is allocated until the first append */
+void outbuf_init(outbuf * buf) {
+    buf->data = NULL;
+    buf->len = 0;
+    buf->size = 0;
+}
+
+/* Free the data of a buffer, it is empty again after */
+void outbuf_free(outbuf * buf) {
+    if(buf->data) xfree(buf->data);
+    outbuf_init(buf);
+}
+
+/* Makes room for len more bytes, plus a null for vsnprintf */
+static void outbuf_reserve(outbuf * buf, int len) {
+    if(buf->len + len + 1 <= buf->size) return;
+    int size = buf->size ? buf->size : 256;
+    while(size < buf->len + len + 1) size *= 2;
+    buf->data = buf->data ? xrealloc(buf->data, size) : xmalloc(size);
+    buf->size = size;
+}
+
+/* Append len bytes of data to the buffer. Aborts program on failure */
+void outbuf_append(outbuf * buf, const char * data, int len) {
+    outbuf_reserve(buf, len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+/* Remove the first len bytes of the buffer */
+void outbuf_consume(outbuf * buf, int len) {
+    memmove(buf->data, buf->data + len, buf->len - len);
+    buf->len -= len;
+}
+
+static const char * format_names[] = {"human", "json", "tsv"};
+
+/* Takes a format name (human, json, tsv)
+ * Return: the format if valid, otherwise -1 */
+int out_parse_format(const char * name) {
+    int i;
+    for(i = 0; i < (int) (sizeof(format_names) / sizeof(format_names[0])); i++) {
+        if(strcmp(name, format_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+/* Name of a format, for printing */
+const char * out_format_name(out_format format) {
+    return format_names[format];
+}
+
+/* Select the format of command output. Returns: the previous format */
+out_format out_set_format(out_format format) {
+    out_format previous = current_format;
+    current_format = format;
+    return previous;
+}
+
+/* Format of command output */
+out_format out_get_format(void) {
+    return current_format;
+}
+
+/* Send command output to buf, or to stdout when buf is NULL
+ * Returns: the previous buffer, to restore it after */
+outbuf * out_capture(outbuf * buf) {
+    outbuf * previous = capture;
+    capture = buf;
+    return previous;
+}
+
+/* Buffer output currently goes to */
+static outbuf * target(void) {
+    return capture ? capture : &stdout_buf;
+}
+
+/* vsprintf at the end of a buffer, most lines are formatted once */
+static void outbuf_vprintf(outbuf * buf, const char * format, va_list args) {
+    va_list again;
+    va_copy(again, args);
+    outbuf_reserve(buf, 128);
+    int room = buf->size - buf->len;
+    int len = vsnprintf(buf->data + buf->len, room, format, args);
+    if(len >= room) {
+        outbuf_reserve(buf, len);
+        vsnprintf(buf->data + buf->len, len + 1, format, again);
+    }
+    if(len > 0) buf->len += len;
+    va_end(again);
+}
+
+/* Appends len bytes of text escaped for the current format */
+static void append_escaped(outbuf * buf, const char * text, int len) {
+    outbuf_reserve(buf, len * 2 + 2); //every escape doubles a byte at most, before \u
+    int i;
+    for(i = 0; i < len; i++) {
+        unsigned char c = text[i];
+        const char * escape = NULL;
+        if(c == '\\') escape = "\\\\";
+        else if(c == '\t') escape = "\\t";
+        else if(c == '\n') escape = "\\n";
+        else if(c == '\r') escape = "\\r";
+        else if(c == '"' && current_format == OUT_JSON) escape = "\\\"";
+
+        if(escape) {
+            outbuf_append(buf, escape, 2);
+        } else if(c < 0x20 && current_format == OUT_JSON) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            outbuf_append(buf, code, 6);
+        } else {
+            outbuf_reserve(buf, 1);
+            buf->data[buf->len++] = c;
+        }
+    }
+}
+
+/* Emits len bytes of free text as a message record */
+static void message_record(const char * text, int len) {
+    out_record("message");
+    outbuf * buf = target();
+    if(current_format == OUT_JSON) {
+        outbuf_append(buf, ",\"text\":\"", 9);
+        append_escaped(buf, text, len);
+        outbuf_append(buf, "\"", 1);
+    } else {
+        outbuf_append(buf, "\t", 1);
+        append_escaped(buf, text, len);
+    }
+    out_end_record();
+}
+
+/* printf for command output, a message record per line in json and tsv */
+void out_printf(const char * format, ...) {
+    va_list args;
+    va_start(args, format);
+    if(current_format == OUT_HUMAN) {
+        outbuf_vprintf(target(), format, args);
+        va_end(args);
+        return;
+    }
+
+    outbuf_vprintf(&pending, format, args); //text waits here until its line is complete
+    va_end(args);
+    int start = 0;
+    char * end;
+    while((end = memchr(pending.data + start, '\n', pending.len - start))) {
+        message_record(pending.data + start, end - pending.data - start);
+        start = end - pending.data + 1;
+    }
+    if(start) outbuf_consume(&pending, start);
+}
+
+/* perror for command output, errors go to stderr in human format when not captured */
+void out_perror(const char * message) {
+    if(!capture && current_format == OUT_HUMAN) {
+        perror(message);
+        return;
+    }
+    out_printf("%s: %s\n", message, strerror(errno));
+}
+
+/* Start a record of type, the fields follow in a fixed order. json and tsv only */
+void out_record(const char * type) {
+    outbuf * buf = target();
+    if(current_format == OUT_JSON) {
+        outbuf_append(buf, "{\"type\":\"", 9);
+        outbuf_append(buf, type, strlen(type));
+        outbuf_append(buf, "\"", 1);
+    } else {
+        outbuf_append(buf, type, strlen(type));
+    }
+}
+
+/* Appends the separator and name of a field */
+static void field_name(outbuf * buf, const char * name) {
+    if(current_format == OUT_JSON) {
+        outbuf_append(buf, ",\"", 2);
+        outbuf_append(buf, name, strlen(name));
+        outbuf_append(buf, "\":", 2);
+    } else {
+        outbuf_append(buf, "\t", 1);
+    }
+}
+
+/* Add a field to the current record */
+void out_field_int(const char * name, long value) {
+    outbuf * buf = target();
+    field_name(buf, name);
+    char number[32];
+    outbuf_append(buf, number, snprintf(number, sizeof(number), "%ld", value));
+}
+
+void out_field_double(const char * name, double value) {
+    outbuf * buf = target();
+    field_name(buf, name);
+    if(current_format == OUT_JSON && !isfinite(value)) { //json has no nan or inf
+        outbuf_append(buf, "null", 4);
+        return;
+    }
+    char number[64];
+    outbuf_append(buf, number, snprintf(number, sizeof(number), "%.6f", value));
+}
+
+void out_field_str(const char * name, const char * value) {
+    outbuf * buf = target();
+    field_name(buf, name);
+    if(current_format == OUT_JSON) outbuf_append(buf, "\"", 1);
+    append_escaped(buf, value, strlen(value));
+    if(current_format == OUT_JSON) outbuf_append(buf, "\"", 1);
+}
+
+/* End the current record */
+void out_end_record(void) {
+    if(current_format == OUT_JSON) outbuf_append(target(), "}\n", 2);
+    else outbuf_append(target(), "\n", 1);
+}
+
+/* Ends the output of a command. Output for stdout is written with one write */
+void out_flush(void) {
+    if(pending.len) { //text without a final newline
+        message_record(pending.data, pending.len);
+        pending.len = 0;
+    }
+    if(capture || !stdout_buf.len) return;
+
+    fflush(stdout); //anything printed with stdio goes first
+    int written = 0;
+    while(written < stdout_buf.len) {
+        ssize_t ret = write(STDOUT_FILENO, stdout_buf.data + written, stdout_buf.len - written);
+        if(ret < 0 && errno == EINTR) continue;
+        if(ret <= 0) break; //stdout is gone, drop the output
+        written += ret;
+    }
+    stdout_buf.len = 0; //the buffer is kept for the next command
+}
@@ -0,0 +1,74 @@
+/* Command output header. Commands print through out_printf and the record
+ * functions into one reusable buffer, written to stdout with a single
+ * write by out_flush, or into a capture buffer (socket clients).
+ *
+ * Formats: human is free text. json prints one object per line and tsv
+ * one tab separated row per line, both start with the record type and
+ * keep their fields in a fixed order. Free text becomes message records */
+
+#ifndef _OUTPUT_H
+#define _OUTPUT_H
+
+/* Struct for a growable output buffer */
+typedef struct outbuf {
+    char * data; //not null terminated
+    int len;
+    int size;
+} outbuf;
+
+typedef enum out_format {
+    OUT_HUMAN,
+    OUT_JSON, //{"type":"job","pid":12,"name":"sleep"}
+    OUT_TSV   //job	12	sleep
+} out_format;
+
+/* Initiate an empty buffer, nothing is allocated until the first append */
+void outbuf_init(outbuf * buf);
+
+/* Free the data of a buffer, it is empty again after */
+void outbuf_free(outbuf * buf);
+
+/* Append len bytes of data to the buffer. Aborts program on failure */
+void outbuf_append(outbuf * buf, const char * data, int len);
+
+/* Remove the first len bytes of the buffer */
+void outbuf_consume(outbuf * buf, int len);
+
+/* Takes a format name (human, json, tsv)
+ * Return: the format if valid, otherwise -1 */
+int out_parse_format(const char * name);
+
+/* Name of a format, for printing */
+const char * out_format_name(out_format format);
+
+/* Select the format of command output. Returns: the previous format */
+out_format out_set_format(out_format format);
+
+/* Format of command output */
+out_format out_get_format(void);
+
+/* Send command output to buf, or to stdout when buf is NULL
+ * Returns: the previous buffer, to restore it after */
+outbuf * out_capture(outbuf * buf);
+
+/* printf for command output, a message record per line in json and tsv */
+void out_printf(const char * format, ...) __attribute__((format(printf, 1, 2)));
+
+/* perror for command output, errors go to stderr in human format when not captured */
+void out_perror(const char * message);
+
+/* Start a record of type, the fields follow in a fixed order. json and tsv only */
+void out_record(const char * type);
+
+/* Add a field to the current record, a double that is not finite is null in json */
+void out_field_int(const char * name, long value);
+void out_field_double(const char * name, double value);
+void out_field_str(const char * name, const char * value);
+
+/* End the current record */
+void out_end_record(void);
+
+/* Ends the output of a command. Output for stdout is written with one write */
+void out_flush(void);
+
+#endif
@@ -0,0 +1,127 @@
+/* Performance counter implementation code */
+
+#define MEM_TAG MEM_STATS
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+#include "utils.h"
+
+static const unsigned long long hardware_events[PERF_EVENTS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+static const unsigned long long software_events[PERF_EVENTS] = {
+    PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_SW_PAGE_FAULTS, PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_CPU_MIGRATIONS};
+static const char * hardware_names[PERF_EVENTS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+static const char * software_names[PERF_EVENTS] = {"task_clock_ns", "page_faults", "context_switches", "cpu_migrations"};
+
+/* Layout of a group read with the read_format used here */
+typedef struct group_reading {
+    unsigned long long nr;
+    unsigned long long time_enabled;
+    unsigned long long time_running;
+    unsigned long long values[PERF_EVENTS];
+} group_reading;
+
+/* Ways to open a group, tried in order until one works */
+static const struct perf_attempt {
+    int hardware;
+    int inherit; //count the processes the job starts too
+    int exclude_kernel; //needed at perf_event_paranoid 2, software events like context switches happen in the kernel
+} attempts[] = {{1, 1, 1}, {1, 0, 1}, {0, 1, 0}, {0, 1, 1}, {0, 0, 1}};
+
+/* Opens one group of events on pid into fds
+ * Returns: -1 on failure with errno set, 0 otherwise */
+static int open_group(pid_t pid, const struct perf_attempt * attempt, int * fds) {
+    const unsigned long long * events = attempt->hardware ? hardware_events : software_events;
+    int i;
+    for(i = 0; i < PERF_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = attempt->hardware ? PERF_TYPE_HARDWARE : PERF_TYPE_SOFTWARE;
+        attr.config = events[i];
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = attempt->exclude_kernel;
+        attr.exclude_hv = 1;
+        attr.inherit = attempt->inherit;
+        if(i == 0) { //the leader switches the whole group
+            attr.disabled = 1;
+            attr.enable_on_exec = 1;
+        }
+
+        fds[i] = syscall(SYS_perf_event_open, &attr, pid, -1, i ? fds[0] : -1, PERF_FLAG_FD_CLOEXEC);
+        if(fds[i] < 0) {
+            int err = errno;
+            while(i--) close(fds[i]);
+            errno = err;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Summary: Opens a disabled counter group on pid
+ * Description: Hardware events first, software events when the PMU is
+ * missing or blocked (containers, virtual machines). Groups without
+ * inherit are tried for kernels that refuse inherit for group reads
+ * Takes:
+ *        pid: child held before its exec
+ * Returns: the group, NULL on failure with errno set */
+perf_group * perf_attach(pid_t pid) {
+    perf_group * group = xmalloc(sizeof(perf_group));
+    int i;
+    for(i = 0; i < (int) (sizeof(attempts) / sizeof(attempts[0])); i++) {
+        if(open_group(pid, &attempts[i], group->fds) == 0) {
+            group->hardware = attempts[i].hardware;
+            return group;
+        }
+    }
+
+    int err = errno;
+    xfree(group);
+    errno = err;
+    return NULL;
+}
+
+/* Read every counter of the group with one read
+ * Returns: -1 on failure with errno set, 0 otherwise */
+int perf_read(perf_group * group, perf_values * values) {
+    group_reading reading;
+    ssize_t ret;
+    do {
+        ret = read(group->fds[0], &reading, sizeof(reading));
+    } while(ret < 0 && errno == EINTR);
+    if(ret < 0) return -1;
+    if(ret != sizeof(reading) || reading.nr != PERF_EVENTS) {
+        errno = EIO;
+        return -1;
+    }
+
+    values->hardware = group->hardware;
+    values->running = reading.time_enabled ? (double) reading.time_running / reading.time_enabled : 0;
+    int i;
+    for(i = 0; i < PERF_EVENTS; i++) { //the counters only ran part of the time when multiplexed
+        values->counts[i] = reading.time_running && reading.time_running < reading.time_enabled
+                            ? reading.values[i] * ((double) reading.time_enabled / reading.time_running)
+                            : reading.values[i];
+    }
+    return 0;
+}
+
+/* Name of a counter, for printing */
+const char * perf_event_name(int hardware, int event) {
+    return hardware ? hardware_names[event] : software_names[event];
+}
+
+/* Close the counters and free the group */
+void perf_close(perf_group * group) {
+    int i;
+    for(i = 0; i < PERF_EVENTS; i++) close(group->fds[i]);
+    xfree(group);
+}
@@ -0,0 +1,53 @@
+/* Performance counter header. A job started with --perf gets a group of
+ * perf_event_open counters, attached before its exec and enabled by it.
+ * Hardware counters are tried first, software ones where the PMU is not
+ * available. The whole group is read with one read */
+
+#ifndef _PERF_H
+#define _PERF_H
+
+#include <sys/types.h>
+
+#define PERF_EVENTS 4
+
+/* Hardware events, in the order of perf_values.counts */
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_CACHE_MISSES 2
+#define PERF_BRANCH_MISSES 3
+
+/* Software events of the fallback, in the order of perf_values.counts */
+#define PERF_TASK_CLOCK 0 //nanoseconds on a cpu
+#define PERF_PAGE_FAULTS 1
+#define PERF_CONTEXT_SWITCHES 2
+#define PERF_CPU_MIGRATIONS 3
+
+/* Struct for the counter group of a job */
+typedef struct perf_group {
+    int fds[PERF_EVENTS]; //fds[0] leads the group
+    int hardware; //1 for hardware events, 0 for the software fallback
+} perf_group;
+
+/* Struct for one reading of a group */
+typedef struct perf_values {
+    int hardware;
+    unsigned long long counts[PERF_EVENTS]; //scaled up when the group was multiplexed
+    double running; //fraction of the enabled time the group was counting, 0 before exec
+} perf_values;
+
+/* Opens a disabled counter group on pid (and the processes it starts),
+ * enabled when pid execs. pid must not have exec'd yet
+ * Returns: the group, NULL on failure with errno set */
+perf_group * perf_attach(pid_t pid);
+
+/* Read every counter of the group with one read
+ * Returns: -1 on failure with errno set, 0 otherwise */
+int perf_read(perf_group * group, perf_values * values);
+
+/* Name of a counter, for printing */
+const char * perf_event_name(int hardware, int event);
+
+/* Close the counters and free the group */
+void perf_close(perf_group * group);
+
+#endif
@@ -0,0 +1,260 @@
+/* Job placement implementation code */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sched.h>
+
+#include "output.h"
+#include "placement.h"
+
+#define PLACEMENT_MAX_NODES 63 //nodes one word of a mempolicy mask holds
+
+static const char * policy_names[] = {"other", "batch", "idle", "fifo"};
+static const int policies[] = {SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO};
+
+static int cpu_jobs[CPU_SETSIZE]; //spread jobs running on each cpu
+static int node_jobs[PLACEMENT_MAX_NODES];
+static int next_cpu = 0; //searches start after the last pick, so ties rotate
+static int next_node = 0;
+
+//cpus of each NUMA node, read from sysfs on first use
+static int nodes_read = 0;
+static int node_present[PLACEMENT_MAX_NODES];
+static cpu_set_t node_cpu_sets[PLACEMENT_MAX_NODES];
+
+/* Set a placement to keep pman's own settings */
+void placement_init(placement * place) {
+    place->set_cpus = 0;
+    CPU_ZERO(&place->cpus);
+    place->node = -1;
+    place->set_nice = 0;
+    place->nice = 0;
+    place->policy = -1;
+    place->spread = SPREAD_NONE;
+}
+
+/* Takes a cpu list like 0-3,8,10-11
+ * Returns: -1 if invalid or a cpu is too big, 0 otherwise */
+int parse_cpu_list(const char * list, cpu_set_t * cpus) {
+    CPU_ZERO(cpus);
+    const char * pos = list;
+    while(*pos) {
+        char * end;
+        if(*pos < '0' || *pos > '9') return -1;
+        long low = strtol(pos, &end, 10);
+        long high = low;
+        if(*end == '-') {
+            if(end[1] < '0' || end[1] > '9') return -1;
+            high = strtol(end + 1, &end, 10);
+        }
+        if(low > high || high >= CPU_SETSIZE) return -1;
+        for(; low <= high; low++) CPU_SET(low, cpus);
+
+        if(*end == ',' && end[1]) end++;
+        else if(*end) return -1;
+        pos = end;
+    }
+    return CPU_COUNT(cpus) ? 0 : -1;
+}
+
+/* Reads the cpus of every NUMA node once. Without NUMA support in the
+ * kernel there are no nodes */
+static void read_nodes(void) {
+    if(nodes_read) return;
+    nodes_read = 1;
+
+    int node;
+    for(node = 0; node < PLACEMENT_MAX_NODES; node++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE * fp = fopen(path, "r");
+        if(!fp) continue;
+        char line[4096];
+        if(fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\n")] = 0;
+            node_present[node] = 1;
+            if(parse_cpu_list(line, &node_cpu_sets[node]) < 0) CPU_ZERO(&node_cpu_sets[node]); //memory only
+        }
+        fclose(fp);
+    }
+}
+
+/* Parses an int of the whole string
+ * Returns: -1 if invalid, 0 otherwise */
+static int parse_int(const char * text, int * value) {
+    char * end;
+    long parsed = strtol(text, &end, 10);
+    if(!*text || *end) return -1;
+    *value = parsed;
+    return 0;
+}
+
+/* Limits the cpus of a placement to cpus */
+static void limit_cpus(placement * place, const cpu_set_t * cpus) {
+    if(place->set_cpus) {
+        CPU_AND(&place->cpus, &place->cpus, cpus);
+    } else {
+        place->cpus = *cpus;
+        place->set_cpus = 1;
+    }
+}
+
+/* Summary: Parses one placement option
+ * Description: --cpus list, --node N (its memory and cpus), --nice N,
+ * --policy other|batch|idle|fifo and --spread cpu|node. --cpus and
+ * --node together keep the cpus in both
+ * Takes:
+ *        args: the option, then its value
+ *        place: placement to update
+ * Returns: number of arguements used, 0 if args[0] is not a placement
+ * option, -1 on an invalid value (the error is printed) */
+int placement_parse_option(char * * args, placement * place) {
+    const char * option = args[0];
+    const char * value = args[1];
+    if(strcmp(option, "--cpus") != 0 && strcmp(option, "--node") != 0 && strcmp(option, "--nice") != 0
+       && strcmp(option, "--policy") != 0 && strcmp(option, "--spread") != 0) return 0;
+    if(!value) {
+        out_printf("Missing value for %s\n", option);
+        return -1;
+    }
+
+    if(strcmp(option, "--cpus") == 0) {
+        cpu_set_t cpus;
+        if(parse_cpu_list(value, &cpus) < 0) {
+            out_printf("Invalid cpu list %s, use a list like 0-3,8\n", value);
+            return -1;
+        }
+        cpu_set_t usable; //cpus that are offline or outside pman's cpuset would fail in the child
+        if(sched_getaffinity(0, sizeof(usable), &usable) == 0) {
+            CPU_AND(&usable, &usable, &cpus);
+            if(!CPU_COUNT(&usable)) {
+                out_printf("None of the cpus %s can be used\n", value);
+                return -1;
+            }
+        }
+        limit_cpus(place, &cpus);
+    } else if(strcmp(option, "--node") == 0) {
+        int node;
+        read_nodes();
+        if(parse_int(value, &node) < 0 || node < 0 || node >= PLACEMENT_MAX_NODES || !node_present[node]) {
+            out_printf("NUMA node %s not found\n", value);
+            return -1;
+        }
+        place->node = node;
+        if(CPU_COUNT(&node_cpu_sets[node])) limit_cpus(place, &node_cpu_sets[node]);
+    } else if(strcmp(option, "--nice") == 0) {
+        if(parse_int(value, &place->nice) < 0 || place->nice < -20 || place->nice > 19) {
+            out_printf("Invalid nice value %s, use -20 to 19\n", value);
+            return -1;
+        }
+        place->set_nice = 1;
+    } else if(strcmp(option, "--policy") == 0) {
+        int i;
+        for(i = 0; i < (int) (sizeof(policies) / sizeof(policies[0])); i++) {
+            if(strcmp(value, policy_names[i]) == 0) break;
+        }
+        if(i == (int) (sizeof(policies) / sizeof(policies[0]))) {
+            out_printf("Invalid policy %s, use other, batch, idle or fifo\n", value);
+            return -1;
+        }
+        place->policy = policies[i];
+    } else {
+        read_nodes();
+        if(strcmp(value, "cpu") == 0) {
+            place->spread = SPREAD_CPU;
+        } else if(strcmp(value, "node") == 0 && node_present[0]) {
+            place->spread = SPREAD_NODE;
+        } else {
+            out_printf("Invalid spread %s, use cpu or node (node needs NUMA support)\n", value);
+            return -1;
+        }
+    }
+
+    if(place->set_cpus && !CPU_COUNT(&place->cpus)) {
+        out_printf("No cpu is in both --cpus and --node\n");
+        return -1;
+    }
+    return 2;
+}
+
+/* Picks the least used cpu pman may run on among place's cpus
+ * Returns: the cpu, -1 if there is none */
+static int pick_cpu(const placement * place) {
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) < 0) return -1;
+    if(place->set_cpus) CPU_AND(&allowed, &allowed, &place->cpus);
+
+    int best = -1;
+    int i;
+    for(i = 0; i < CPU_SETSIZE; i++) {
+        int cpu = (next_cpu + i) % CPU_SETSIZE;
+        if(CPU_ISSET(cpu, &allowed) && (best < 0 || cpu_jobs[cpu] < cpu_jobs[best])) best = cpu;
+    }
+    if(best >= 0) next_cpu = best + 1;
+    return best;
+}
+
+/* Picks the least used node with cpus, only place's node when it has one
+ * Returns: the node, -1 if there is none */
+static int pick_node(const placement * place) {
+    int best = -1;
+    int i;
+    for(i = 0; i < PLACEMENT_MAX_NODES; i++) {
+        int node = (next_node + i) % PLACEMENT_MAX_NODES;
+        if(!node_present[node] || !CPU_COUNT(&node_cpu_sets[node])) continue;
+        if(place->node >= 0 && node != place->node) continue;
+        if(best < 0 || node_jobs[node] < node_jobs[best]) best = node;
+    }
+    if(best >= 0) next_node = best + 1;
+    return best;
+}
+
+/* Sets the placement fields of spawn for a new job. A spread job claims
+ * a cpu or node, spread_cpu and spread_node are set to it or -1 */
+void placement_apply(const placement * place, spawn_options * spawn, int * spread_cpu, int * spread_node) {
+    *spread_cpu = -1;
+    *spread_node = -1;
+    spawn->set_cpus = place->set_cpus;
+    spawn->cpus = place->cpus;
+    spawn->node = place->node;
+    spawn->set_nice = place->set_nice;
+    spawn->nice = place->nice;
+    spawn->policy = place->policy;
+
+    if(place->spread == SPREAD_CPU) {
+        int cpu = pick_cpu(place);
+        if(cpu < 0) return;
+        cpu_jobs[cpu]++;
+        *spread_cpu = cpu;
+        CPU_ZERO(&spawn->cpus);
+        CPU_SET(cpu, &spawn->cpus);
+        spawn->set_cpus = 1;
+    } else if(place->spread == SPREAD_NODE) {
+        int node = pick_node(place);
+        if(node < 0) return;
+        node_jobs[node]++;
+        *spread_node = node;
+        spawn->node = node;
+        cpu_set_t cpus = node_cpu_sets[node];
+        if(place->set_cpus) CPU_AND(&cpus, &cpus, &place->cpus);
+        spawn->cpus = CPU_COUNT(&cpus) ? cpus : node_cpu_sets[node]; //--cpus elsewhere gives way to the node
+        spawn->set_cpus = 1;
+    }
+}
+
+/* Name of a scheduling policy as --policy takes it, for printing */
+const char * placement_policy_name(int policy) {
+    int i;
+    for(i = 0; i < (int) (sizeof(policies) / sizeof(policies[0])); i++) {
+        if(policies[i] == policy) return policy_names[i];
+    }
+    return "unknown";
+}
+
+/* Gives back the cpu or node a spread job claimed, -1 for none */
+void placement_release(int spread_cpu, int spread_node) {
+    if(spread_cpu >= 0) cpu_jobs[spread_cpu]--;
+    if(spread_node >= 0) node_jobs[spread_node]--;
+}
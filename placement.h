@@ -0,0 +1,52 @@
+/* Job placement header. Parses the cpu, NUMA node, nice and scheduling
+ * policy options of bg and resolves them to spawn options. --spread puts
+ * each new job on the cpu or node running the fewest spread jobs, its
+ * own count of them is kept until the job is reaped */
+
+#ifndef _PLACEMENT_H
+#define _PLACEMENT_H
+
+#include <sched.h>
+
+#include "spawn.h"
+
+typedef enum spread_mode {
+    SPREAD_NONE,
+    SPREAD_CPU, //one cpu per job
+    SPREAD_NODE //one NUMA node per job, memory and cpus
+} spread_mode;
+
+/* Struct for the placement options of a job */
+typedef struct placement {
+    int set_cpus;
+    cpu_set_t cpus; //--cpus, intersected with the cpus of --node
+    int node; //--node, -1 for none
+    int set_nice;
+    int nice;
+    int policy; //-1 keeps pman's
+    spread_mode spread; //picks from cpus or from the nodes when set
+} placement;
+
+/* Set a placement to keep pman's own settings */
+void placement_init(placement * place);
+
+/* Parses one placement option at args[0] with its value
+ * Returns: number of arguements used, 0 if args[0] is not a placement
+ * option, -1 on an invalid value (the error is printed) */
+int placement_parse_option(char * * args, placement * place);
+
+/* Sets the placement fields of spawn for a new job. A spread job claims
+ * a cpu or node, spread_cpu and spread_node are set to it or -1 */
+void placement_apply(const placement * place, spawn_options * spawn, int * spread_cpu, int * spread_node);
+
+/* Gives back the cpu or node a spread job claimed, -1 for none */
+void placement_release(int spread_cpu, int spread_node);
+
+/* Name of a scheduling policy as --policy takes it, for printing */
+const char * placement_policy_name(int policy);
+
+/* Takes a cpu list like 0-3,8,10-11
+ * Returns: -1 if invalid or a cpu is too big, 0 otherwise */
+int parse_cpu_list(const char * list, cpu_set_t * cpus);
+
+#endif
@@ -1,5 +1,8 @@
 /* Main body of code for the pman */
 
+#define MEM_TAG MEM_STATS
+
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
@@ -10,499 +13,632 @@
 #include <assert.h>
 #include <sys/types.h>
 #include <signal.h>
-#include <regex.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
-
-#include "ADTlinkedlist.h"
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "ADThashtable.h"
+#include "capture.h"
+#include "commands.h"
+#include "control.h"
+#include "events.h"
+#include "evloop.h"
+#include "groups.h"
+#include "metrics.h"
+#include "output.h"
+#include "procstat.h"
+#include "proctree.h"
+#include "queue.h"
+#include "spawn.h"
 #include "utils.h"
+#include "watchdog.h"
+
+
+/* State shared with the readline and event loop callbacks */
+static jobtable * loop_jobs = NULL;
+static evloop * main_loop = NULL;
+static int running = 1;
+static int batch_mode = 0; //commands come from a script, no terminal
+static int input_open = 1; //0 once the prompt or script ended while the control socket is served
+static int control_command = 0; //the running command came from the control socket
+static int script_ready = 0; //a polled script has input to read
+
+static const char * prompt = "PMan:  > ";
+void handle_line(char * input);
+
+
+/* Struct for one row of the ptop table */
+typedef struct ptop_row {
+    subprogram * program;
+    char state;
+    double cpu; //percent of one cpu over the interval
+    long rss; //KB
+    double rss_rate; //KB per second
+    double ctxt_rate; //context switches per second
+} ptop_row;
+
+/* State of the running ptop, timer_fd is -1 when ptop is off */
+static int ptop_timer_fd = -1;
+static ptop_row * ptop_rows = NULL; //reused between samples, grow with the job table
+static pid_t * ptop_pids = NULL;
+static procstat * ptop_stats = NULL;
+static int * ptop_ok = NULL;
+static int ptop_rows_size = 0;
+
+/* Sort rows by cpu use, busiest first */
+int compare_ptop_rows(const void * val1, const void * val2) {
+    const ptop_row * r1 = val1;
+    const ptop_row * r2 = val2;
+    if(r1->cpu != r2->cpu) return r1->cpu < r2->cpu ? 1 : -1;
+    return r1->program->pid - r2->program->pid;
+}
 
+/* Summary: Samples every active job and redraws the ptop table
+ * Description: Reads /proc for each job once, rates are computed from the
+ * difference with the previous sample kept in the job
+ * Takes:
+ *        jobs: table of all programs
+ */
+void draw_ptop(jobtable * jobs) {
+    double ticks = sysconf(_SC_CLK_TCK);
+    long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
+    if(ptop_rows_size < jobs->active.num) {
+        ptop_rows_size = jobs->active.num * 2;
+        ptop_rows = ptop_rows ? xrealloc(ptop_rows, sizeof(ptop_row) * ptop_rows_size)
+                              : xmalloc(sizeof(ptop_row) * ptop_rows_size);
+        ptop_pids = ptop_pids ? xrealloc(ptop_pids, sizeof(pid_t) * ptop_rows_size)
+                              : xmalloc(sizeof(pid_t) * ptop_rows_size);
+        ptop_stats = ptop_stats ? xrealloc(ptop_stats, sizeof(procstat) * ptop_rows_size)
+                                : xmalloc(sizeof(procstat) * ptop_rows_size);
+        ptop_ok = ptop_ok ? xrealloc(ptop_ok, sizeof(int) * ptop_rows_size)
+                          : xmalloc(sizeof(int) * ptop_rows_size);
+    }
 
-/* Struct for background programs */
-typedef struct subprogram {
-    char * name;
-    pid_t pid;
-} subprogram;
-
-/* Comparison function for subprograms, only compares pid */
-int compare_programs(void * val1, void * val2) {
-    subprogram * p1 = (subprogram *) val1;
-    subprogram * p2 = (subprogram *) val2;
-    if ( p1->pid == p2->pid ) {
-        return 1;
+    int total = 0;
+    ADThashnode * node = jobs->active.head;
+    for(; node; node = node->next) ptop_pids[total++] = node->key;
+    procstat_read_many(ptop_pids, ptop_stats, ptop_ok, total);
+    double time = monotonic_seconds();
+
+    int num = 0;
+    double total_cpu = 0;
+    int i;
+    for(i = 0; i < total; i++) {
+        if(!ptop_ok[i]) continue; //exited, reaped soon
+        subprogram * program = (subprogram *) adtFindHashNode(&jobs->active, ptop_pids[i])->val;
+        procstat * stats = &ptop_stats[i];
+
+        unsigned long cpu = stats->utime + stats->stime;
+        long ctxt = stats->voluntary_ctxt_switches + stats->nonvoluntary_ctxt_switches;
+        ptop_row * row = &ptop_rows[num++];
+        row->program = program;
+        row->state = stats->state;
+        row->rss = stats->rss * page_kb;
+        row->cpu = row->rss_rate = row->ctxt_rate = 0;
+
+        job_sample * last = &program->sample;
+        if(last->time > 0 && time > last->time) { //rates need a previous sample
+            double elapsed = time - last->time;
+            row->cpu = (cpu - last->cpu) / ticks / elapsed * 100;
+            row->rss_rate = (stats->rss - last->rss) * page_kb / elapsed;
+            row->ctxt_rate = (ctxt - last->ctxt) / elapsed;
+        }
+        total_cpu += row->cpu;
+        last->time = time;
+        last->cpu = cpu;
+        last->rss = stats->rss;
+        last->ctxt = ctxt;
     }
 
-    return 0;
+    qsort(ptop_rows, num, sizeof(ptop_row), compare_ptop_rows);
+
+    int lines = 24; //only draw rows that fit on screen
+    struct winsize size;
+    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0) lines = size.ws_row;
+    int shown = num < lines - 4 ? num : lines - 4;
+    if(shown < 0) shown = 0;
+
+    printf("\033[H\033[2J" //clear the screen
+           "ptop: %d jobs, %.1f%% cpu total. Press any key to return\n\n"
+           "Pid      State   Cpu%%     Rss(KB)   dRss(KB/s)   Ctxt/s  Name\n",
+           num, total_cpu);
+    for(i = 0; i < shown; i++) {
+        ptop_row * row = &ptop_rows[i];
+        printf("%-8d %-5c %6.1f %11ld %12.1f %8.1f  %s\n", row->program->pid, row->state,
+               row->cpu, row->rss, row->rss_rate, row->ctxt_rate, row->program->name);
+    }
+    fflush(stdout);
 }
 
-/* Specialized memory freeing funtion ADTLinked node with a subprogram in it*/
-void free_node(ADTlinkednode * node) {
-    if( node->val) {
-        subprogram * prog = (subprogram *) node->val;
-        xfree(prog->name);
-        xfree(node->val);
-    }
-    xfree(node);
+/* Event loop callback for the ptop timerfd */
+void on_ptop_timer(int fd, unsigned int events, void * data) {
+    (void) events;
+    unsigned long long expirations = 0;
+    if(read(fd, &expirations, sizeof(expirations)) < 0) return; //drop missed ticks
+    draw_ptop((jobtable *) data);
 }
 
-/*
- * Summary: Attempts to create a new process
- * Description: Creates a process using the self-pipe trick to detect
- * failures in exec. Prints an error message on failure.
+/* Summary: Starts the ptop display
+ * Description: Takes over the terminal from readline, then redraws the
+ * table every interval until a key is pressed (see stop_ptop)
  * Takes:
- *       programs: linked list of all subprograms
- *       args: array of arguements, 0 assumed to be program name
+ *        jobs: table of all programs
+ *        interval: ms between samples
+ * Returns: -1 on failure, 0 otherwise
  */
-void create_process(ADTlinkedlist * programs, char * args[]) {
-
-    int pipes[2] = {0}; //assume 0 pipes are unintialized
-
-    if (pipe(pipes) < 0) {
-        perror("Aborting. Creating self pipes failed");
-        goto end;
+int start_ptop(jobtable * jobs, int interval) {
+    ptop_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(ptop_timer_fd < 0) {
+        perror("Aborting. Creating the ptop timer failed");
+        return -1;
     }
 
-    int flags = fcntl(pipes[1], F_GETFD); //set write pipe to close on exec
-    if (flags < 0) {
-        perror("Aborting. Getting flgas of pipe failed");
-        goto end;
+    struct itimerspec spec = {0};
+    spec.it_interval.tv_sec = interval / 1000;
+    spec.it_interval.tv_nsec = (interval % 1000) * 1000000L;
+    spec.it_value = spec.it_interval;
+    if(timerfd_settime(ptop_timer_fd, 0, &spec, NULL) < 0
+       || evloop_add(main_loop, ptop_timer_fd, EPOLLIN, on_ptop_timer, jobs) < 0) {
+        perror("Aborting. Starting the ptop timer failed");
+        close(ptop_timer_fd);
+        ptop_timer_fd = -1;
+        return -1;
     }
 
-    if (fcntl(pipes[1], F_SETFD, flags | FD_CLOEXEC) < 0) {
-        perror("Aborting. Could not set flags for pipe");
-        goto end;
-    }
-
-    pid_t child = fork();
-    if(child < 0) {
-        perror("Aborting. Creating the child process failed");
-    } else if( child == 0 ) { //child action
-
-        if(close(pipes[0]) < 0 ) perror("Warning: Closing read pipe failed");
-
-        execvp(args[0], args); //this will auto-close pipe if it dosen't return
-
-        perror("Aborting. Execv failed (is the program valid?)");
-        char fail = 'f'; //if something failed let parrent process know
-        write(pipes[1],&fail,sizeof(char));
-        if( close(pipes[1]) < 0 ) perror("Closing write pipe failed");
-        exit(1);
-
-    } else { //parent action
-
-        if(close(pipes[1]) < 0 ) perror("Warning. Closing write pipe failed"); //close write pipe
-        pipes[1] = 0; //zero pipe id
-
-        char code = 0;
-        int bytes_read = read(pipes[0],&code,sizeof(char)); //this will return on exec or exec failure
-        if(bytes_read < 0) perror("Warning. Reading from pipe failed");
-
-        if( bytes_read) { //child failed to exec since it printed to pipe
-
-            int status = 0;
-            if( waitpid(child,&status, 0) < 0 ) perror("Waitpid for exec process failed"); //check status so OS can clean up zombie
-            child = -1;
-
-        } else {//othersie the pipe had no output, so exec must have succeded
-
-            subprogram * val = xmalloc(sizeof(subprogram));
-            val->pid = child;
-
-            char * name = xmalloc(sizeof(char) * (strlen(args[0])+1) );
-            strcpy(name,args[0]);
-            val->name = name;
-
-            ADTlinkednode * node = xmalloc(sizeof(ADTlinkednode));
-            adtInitiateLinkedNode(node,val);
-            adtAddLinkedNode(programs,node,0);
-
-            printf("%s(pid=%d) started\n",args[0],child);
-        }
+    rl_callback_handler_remove(); //keys go to ptop until it stops
+    rl_prep_terminal(0); //unbuffered so a single key stops ptop
+    draw_ptop(jobs);
+    return 0;
+}
 
+/* Summary: Stops the ptop display on a key press
+ * Description: Consumes the key and gives the terminal back to readline
+ */
+void stop_ptop(void) {
+    char key[64];
+    if(isatty(STDIN_FILENO)) {
+        if(read(STDIN_FILENO, key, sizeof(key)) < 0) return;
+    } else { //a script, consume the rest of the line
+        while(read(STDIN_FILENO, key, 1) == 1 && key[0] != '\n');
     }
 
-end:
-    if(pipes[0] && close(pipes[0]) < 0) perror("Closing read pipe failed"); //close any pipes that are open (non-zero value)
-    if(pipes[1] && close(pipes[1]) < 0) perror("Closing write read pipe failed");
+    evloop_remove(main_loop, ptop_timer_fd);
+    close(ptop_timer_fd);
+    ptop_timer_fd = -1;
 
+    rl_deprep_terminal();
+    printf("\n");
+    rl_callback_handler_install(prompt, handle_line);
 }
 
 
-/* Summary: Send a signal to a process if it is still alive
- * Description: Takes an array of strings of pids that is null terminated
- * Sends the signal to each valid process token
+/* Summary: Runs a single command line
+ * Description: Implements commands from assignment. The exit command
+ * stops the main loop. Output is written once the command finished.
  * Takes:
- *        programs: linked list of all programs
- *        processes: strings of process ids
- *        signal: signal type to send to each process
+ *        jobs: table of all programs
+ *        input: line to run
+ * Returns: -1 if the command failed, 0 otherwise
  */
-void send_signal(ADTlinkedlist * programs, char * * processes, int signal) {
-    for(; *processes ; processes++) {
-
-        pid_t pid;
-        if( (pid = extract_pid(*processes)) == -1 ) {
-            printf("Invalid pid, skipping %s\n", *processes);
-            continue;
+int run_command(jobtable * jobs, char * input) {
+    unsigned long long start = metrics_now();
+    int ret = -1; //usage errors fail
+    char * * tokens =  get_tokens(input);
+    if(!tokens) return 0;
+    const char * name = tokens[0]; //histogram of the command
+
+    if(strcmp(tokens[0], "bg") == 0) {
+        if( tokens[1] == NULL) {
+            out_printf("Program not provided\nusage: bg [options] program [arg1 arg2...]\n");
+        } else {
+            ret = create_process(jobs, tokens + 1);
         }
-
-        subprogram comparison; //comparison val, compares function ignores name field
-        comparison.pid = pid;
-        int index = 0;
-        if( (index = adtFindLinkedValue(programs,&comparison,compare_programs)) < 0 ) {
-            printf("Cannot send %s to %d(PID UNKNOWN) \n", strsignal(signal), pid);
-            continue;
+    } else if(strcmp(tokens[0], "bgmany") == 0) {
+        if( tokens[1] == NULL) {
+            out_printf("Nothing to start\nusage: bgmany [options] count program [arg1 arg2...] | bgmany -f file\n");
+        } else {
+            ret = create_many(jobs, tokens + 1);
         }
-
-        int status = 0;
-        int pid_ret = waitpid(pid,&status,WNOHANG);
-
-        if(pid_ret < 0) {
-            perror("Aborting all: a waitpid call failed");
-            return;
+    } else if(strcmp(tokens[0],"bgqueue") == 0) {
+        ret = queue_command(jobs, tokens + 1);
+    } else if(strcmp(tokens[0],"bgout") == 0) {
+        if( tokens[1] == NULL) {
+            out_printf("No pid provided\nusage: bgout pid [lines|all]\n");
+        } else {
+            ret = print_output(jobs, tokens + 1);
         }
-
-        if(pid_ret > 0) {
-            ADTlinkednode * node = adtPopLinkedNode(programs,index);
-
-            if(WIFSIGNALED(status)) { //two casses
-                printf("No signal sent to %s (pid=%d), it has been killed\n",  ((subprogram *) node->val)->name, pid);
-            } else if (WIFEXITED(status)) { //two casses
-                printf("No signal sent to %s (pid=%d), it has exited\n",  ((subprogram *) node->val)->name, pid);
-            } else {
-                fprintf(stderr,"WARNING: got signal from waitpid with no handaler, will assume it died!\n");
-            }
-
-            free_node(node);
-
+    } else if(strcmp(tokens[0],"bglist") == 0) {
+        if( tokens[1] == NULL) {
+            check_execution(jobs);
+            ret = 0;
         } else {
-
-            if (kill(pid,signal) == -1) {
-                perror("Aborting all. Sending signal failed");
-                return;
-            }
-
-            printf("%s sent to %d\n",strsignal(signal), pid);
-
+            out_printf("Additional values provided to bglist, should be none\nusage: bglist\n");
         }
 
-    }
-}
-
-
- /* Summary: Prints stats for proceses
- * Description: Takes an array of strings of pids that is null terminated
- * Gets the stats for each valid process token
- * Takes:
- *        programs: linked list of all programs
- *        processes: strings of process ids
- */
-void print_stats(ADTlinkedlist * programs, char * * processes) {
-    int buffer_size = 2000; //io and file name splicing
-    char * buffer = xmalloc(sizeof(char)*buffer_size);
-
-    regex_t expr = {0};
-    char * pattern = "voluntary_ctxt_switches:[[:space:]{1,}]([[:digit:]]{1,})[[:space:]{1,}]nonvoluntary_ctxt_switches:[[:space:]{1,}]([[:digit:]]{1,})";
-    if( regcomp(&expr, pattern, REG_EXTENDED) != 0  ) {
-        printf("Aborting all, compiling regex failed\n");
-        goto end;
-    }
-
-    for(; *processes ; processes++) {
-
-        pid_t pid = 0;
-        if( (pid = extract_pid(*processes)) == -1) {
-            printf("Skiping invalid program id: %s\n", *processes);
-            continue;
+    } else if(strcmp(tokens[0],"bgkill") == 0) { //ERROR: Process 1245 does not exist.
+        if( tokens[1] == NULL) {
+            out_printf("No pid provided\nusage: bgkill [--tree] pid|selector [...]\n");
+        } else {
+            ret = send_signal(jobs,tokens+1, SIGKILL);
         }
-
-        int index = 0;
-        subprogram comparison; //comparison val, compare function ignore name field
-        comparison.pid = pid;
-        if( (index = adtFindLinkedValue(programs,&comparison,compare_programs)) < 0 ) {
-            printf("Cannot send signal to pid=%d(UNKNOWN PID)\n",pid);
-            continue;
+    } else if(strcmp(tokens[0],"bgstop") == 0) {
+        if( tokens[1] == NULL) {
+            out_printf("No pid provided\nusage: bgstop [--tree] pid|selector [...]\n");
+        } else {
+            ret = send_signal(jobs,tokens+1, SIGSTOP);
         }
-
-        ADTlinkednode * node = adtPeakLinkedNode(programs, index);
-
-        // to be taken from /proc/pid/stat
-        char status = 0;
-        double utime = 0;
-        double stime = 0;
-        long int rss = 0;
-        //to be taken from /proc/pid/status
-        int voluntary_ctxt_switches = 0;
-        int nonvoluntary_ctxt_switches = 0;
-
-
-        //Each file must be read all at once, since it dosen't support file positions
-        snprintf(buffer, buffer_size,"/proc/%d/stat", pid);
-        FILE * fp_stat = fopen(buffer,"r");
-        if( !fp_stat ) {
-            perror("Opening pid file failed");
-            printf("Skipping pid = %d .Failed to read from /proc/%d/stat",pid,pid);
-            continue; //skip this pid
+    } else if(strcmp(tokens[0],"bgstart") == 0) {
+        if( tokens[1] == NULL) {
+            out_printf("No pid provided\nusage: bgstart [--tree] pid|selector [...]\n");
+        } else {
+            ret = send_signal(jobs,tokens+1, SIGCONT);
         }
+    } else if(strcmp(tokens[0],"pstat") == 0) {
 
-        int buffer_end = 0; //handle bigger file size
-        do {
-            buffer_end = fread(buffer,sizeof(char),buffer_size -1, fp_stat);
-            if( buffer_end == buffer_size -1) {
-                buffer_size *= 2;
-                char * tmp = realloc(buffer, buffer_size);
-                assert(tmp);
-                buffer = tmp;
+        if( tokens[1] == NULL) {
+            out_printf("No program id provided\nusage: pstat [--perf] pid|selector [...]\n");
+        } else {
+            ret = print_stats(jobs,tokens+1);
+        }
+    } else if(strcmp(tokens[0],"ptop") == 0) {
+        int interval = 1000;
+        if( tokens[1] && (tokens[2] || (interval = extract_pid(tokens[1])) < 10) ) {
+            out_printf("Invalid interval, at least 10ms\nusage: ptop [interval_ms]\n");
+        } else if( batch_mode || control_command ) {
+            out_printf("ptop needs a terminal, not available in batch mode or over the control socket\n");
+        } else {
+            ret = start_ptop(jobs, interval);
+        }
+    } else if(strcmp(tokens[0],"spawn") == 0) {
+        int backend;
+        if( tokens[1] == NULL) {
+            out_printf("Spawn backend: %s\n", spawn_backend_name(spawn_get_backend()));
+            ret = 0;
+        } else if( tokens[2] != NULL || (backend = spawn_parse_backend(tokens[1])) < 0) {
+            out_printf("Invalid spawn backend\nusage: spawn [fork|vfork|posix]\n");
+        } else {
+            spawn_set_backend(backend);
+            out_printf("Spawn backend: %s\n", spawn_backend_name(backend));
+            ret = 0;
+        }
+    } else if(strcmp(tokens[0],"output") == 0) {
+        int format;
+        if( tokens[1] == NULL) {
+            out_printf("Output format: %s\n", out_format_name(out_get_format()));
+            ret = 0;
+        } else if( tokens[2] != NULL || (format = out_parse_format(tokens[1])) < 0) {
+            out_printf("Invalid output format\nusage: output [human|json|tsv]\n");
+        } else {
+            out_set_format(format);
+            out_printf("Output format: %s\n", out_format_name(format));
+            ret = 0;
+        }
+    } else if(strcmp(tokens[0],"bgtree") == 0) {
+        ret = print_tree(jobs, tokens + 1);
+    } else if(strcmp(tokens[0],"watchdog") == 0) {
+        ret = watchdog_command(tokens + 1);
+    } else if(strcmp(tokens[0],"events") == 0) {
+        ret = events_command(tokens + 1);
+    } else if(strcmp(tokens[0],"memstat") == 0) {
+        if( tokens[1] == NULL) {
+            print_memory();
+            ret = 0;
+        } else {
+            out_printf("Additional values provided to memstat, should be none\nusage: memstat\n");
+        }
+    } else if(strcmp(tokens[0],"pmanstat") == 0) {
+        ret = metrics_command(tokens + 1);
+    } else if(strcmp(tokens[0],"jobpool") == 0) {
+        if( tokens[1] == NULL) {
+            print_job_pool();
+            ret = 0;
+        } else {
+            out_printf("Additional values provided to jobpool, should be none\nusage: jobpool\n");
+        }
+    } else if(strcmp(tokens[0],"help") == 0) {
+        out_printf("Function            Command:\n"
+               "Start New Program - bg [options] program [arg1 arg2...]\n"
+               "Start Many        - bgmany [options] count program [arg1 arg2...] | bgmany -f file\n"
+               "Queue Programs    - bgqueue [-j N] [options] program [arg1 arg2...] | bgqueue [-j N] -f file\n"
+               "List Program      - bglist\n"
+               "Output of Program - bgout pid [lines|all]\n"
+               "Stats for Program - pstat [--perf] pid|selector [...]\n"
+               "Process Trees     - bgtree [pid|selector ...]\n"
+               "Top of Programs   - ptop [interval_ms]\n"
+               "Kill Program      - bgkill [--tree] pid|selector [...]\n"
+               "Stop Program      - bgstop [--tree] pid|selector [...]\n"
+               "Resume Progam     - bgstart [--tree] pid|selector [...]\n"
+               "Spawn Backend     - spawn [fork|vfork|posix]\n"
+               "Job Record Pool   - jobpool\n"
+               "pman Latencies    - pmanstat [reset]\n"
+               "pman Memory       - memstat\n"
+               "Kernel Events     - events [on|off]\n"
+               "Job Limits        - watchdog [@group] [--max-rss size] [--max-cpu percent] [--on-limit action]\n"
+               "                    [--interval ms] | watchdog [@group] off\n"
+               "Output Format     - output [human|json|tsv]\n"
+               "Stop pman         - exit | shutdown (also from the control socket)\n"
+               "Options: --group name (start in a group), --capture (keep the output for bgout),\n"
+               "         --perf (count cycles, instructions and misses for pstat --perf)\n"
+               "         --cpus 0-3,8, --node N, --nice N, --policy other|batch|idle|fifo,\n"
+               "         --spread cpu|node (the least used cpu or NUMA node per job),\n"
+               "         --max-rss 2G, --max-cpu 90%%, --on-limit log|stop|term|kill (watchdog limits)\n"
+               "Selectors: all, pid ranges (1200-1300), name:pattern (name:worker*), state:letters (state:T)\n"
+               "Groups: @name signals a whole group at once, bgstop and bgstart freeze its cgroup\n");
+        ret = 0;
+    } else if(strcmp(tokens[0],"exit") == 0 || strcmp(tokens[0],"shutdown") == 0) {
+        running = 0;
+        ret = 0;
+    } else {
+        out_printf("Unknown command: %s\n", input);
+        name = "unknown"; //not one histogram per typo
+    }
 
-            }
-        } while( buffer_end == buffer_size -1 );
-        buffer[buffer_end] = 0;
+    out_flush(); //all output of the command in one write
+    metrics_command_record(name, start);
+    free_tokens(tokens);
+    return ret;
+}
 
-        fclose(fp_stat);
 
+/* Control socket handler, runs a command of a client */
+int run_control_command(char * line) {
+    control_command = 1;
+    int ret = run_command(loop_jobs, line);
+    control_command = 0;
+    return ret;
+}
 
-        if( sscanf(buffer,"%*d %*s %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lf %lf %*d %*d %*d %*d %*d %*d %*d %*u %ld",&status,&utime,&stime,&rss) != 4 ) {
-            printf("Skipping pid = %d .Failed to read from /proc/%d/stat",pid,pid);
-            continue;
-        } //ugly but nessasary to read /proc/pid/stat
+/* Readline callback, called with each complete line (NULL on end of input)
+ * While the control socket is served, end of input only closes the prompt */
+void handle_line(char * input) {
+    if(!input && control_active()) {
+        printf("\nInput closed, serving the control socket until shutdown\n");
+        input_open = 0;
+        evloop_remove(main_loop, STDIN_FILENO); //fails if it was never polled
+        rl_callback_handler_remove();
+        return;
+    } else if(!input) {
+        printf("\n");
+        running = 0;
+    } else {
+        run_command(loop_jobs, input);
+        free(input); //allocated by readline, not by our wrappers
+    }
+    if(!running) rl_callback_handler_remove();
+}
 
-        stime /= sysconf(_SC_CLK_TCK);
-        utime /= sysconf(_SC_CLK_TCK);
+/* Event loop callback for terminal input */
+void on_stdin(int fd, unsigned int events, void * data) {
+    (void) fd; (void) events; (void) data;
+    if(ptop_timer_fd >= 0) stop_ptop();
+    else rl_callback_read_char();
+}
 
+/* Event loop callback for the SIGCHLD signalfd, reaps children as soon as they exit */
+void on_sigchld(int fd, unsigned int events, void * data) {
+    (void) events;
+    struct signalfd_siginfo info[16];
+    while(read(fd, info, sizeof(info)) > 0); //signals coalesce, one reap pass handles them all
+    reap_children((jobtable *) data);
+}
 
-        snprintf(buffer, buffer_size,"/proc/%d/status", pid);
-        FILE * fp_status = fopen(buffer,"r");
 
-        do { //handle posibly bigger file size
-            buffer_end = fread(buffer,sizeof(char),buffer_size -1, fp_status);
-            if( buffer_end == buffer_size -1) {
-                buffer_size *= 2;
-                char * tmp = realloc(buffer, buffer_size);
-                assert(tmp);
-                buffer = tmp;
+/* Event loop callback for a script that can be polled (a pipe or a terminal) */
+void on_script(int fd, unsigned int events, void * data) {
+    (void) fd; (void) events; (void) data;
+    script_ready = 1;
+}
 
+/* Summary: Runs commands from a script
+ * Description: Reads the script with large reads and runs each line as a
+ * command, without readline or a prompt. Child exits are handled between
+ * commands every few lines, and while a piped script waits for input the
+ * event loop runs, so captured output keeps being drained.
+ * Takes:
+ *        jobs: table of all programs
+ *        loop: event loop to service between commands
+ *        fp: script to read, only its fd is used
+ * Returns: number of failed commands
+ */
+int run_batch(jobtable * jobs, evloop * loop, FILE * fp) {
+    int fd = fileno(fp);
+    int polled = evloop_add(loop, fd, EPOLLIN, on_script, NULL) == 0; //regular files are always ready
+    outbuf script;
+    outbuf_init(&script);
+    char chunk[1 << 16];
+    int start = 0; //first byte of the script buffer not run yet
+    int eof = 0;
+    int failed = 0;
+    int lines = 0;
+
+    while(running) {
+        char * end = script.len > start ? memchr(script.data + start, '\n', script.len - start) : NULL;
+        if(!end) {
+            if(eof) break;
+            outbuf_consume(&script, start);
+            start = 0;
+            while(polled && running && !script_ready) {
+                if(evloop_run_once(loop, -1) < 0) break;
             }
-        } while( buffer_end == buffer_size -1 );
-
-        fclose(fp_status);
-
-        int max_matches = 3;
-        regmatch_t matches[max_matches];
-
-        if( regexec(&expr, buffer, max_matches, matches,0) ) {  //check for no matches
-            printf("Skipping pid = %d .Failed to find content in /proc/%d/status\n",pid,pid);
-            continue;
-        }
-
-        int num_chars = matches[1].rm_eo - matches[1].rm_so; //extract voluntary_ctxt_switches
-        char * voluntary_ctxt_switches_group = xmalloc(sizeof(char) * (num_chars + 1)); //room for null
-        int i;
-        for(i =0; i<num_chars; i++) voluntary_ctxt_switches_group[i] = buffer[matches[1].rm_so + i];
-        voluntary_ctxt_switches_group[num_chars] = 0;
-
-        char * endptr = 0;
-        int tmp = strtol(voluntary_ctxt_switches_group, &endptr, 10);
-
-        if( *endptr == 0 ) {
-            voluntary_ctxt_switches = tmp;
-            xfree(voluntary_ctxt_switches_group);
-        } else {
-            printf("Skipping pid = %d .Failed to convert content in /proc/%d/status",pid,pid);
-            xfree(voluntary_ctxt_switches_group);
-            continue;
-        }
-
-        num_chars = matches[2].rm_eo - matches[2].rm_so; //extract non_voluntary_ctxt switches
-        char * nonvoluntary_ctxt_switches_group = xmalloc(sizeof(char) * (num_chars + 1)); //room for null
-        for(i =0; i<num_chars; i++) nonvoluntary_ctxt_switches_group[i] = buffer[matches[2].rm_so + i];
-        nonvoluntary_ctxt_switches_group[num_chars] = 0;
-
-        tmp = strtol(nonvoluntary_ctxt_switches_group, &endptr, 10);
-
-        if(*endptr == 0) {
-            nonvoluntary_ctxt_switches = tmp;
-            xfree(nonvoluntary_ctxt_switches_group);
-        } else {
-            printf("Skipping pid = %d .Failed to read from /proc/%d/stat",pid,pid);
-            xfree(nonvoluntary_ctxt_switches_group);
+            if(!running) break; //shutdown from a control client while waiting
+            script_ready = 0;
+
+            ssize_t len = read(fd, chunk, sizeof(chunk));
+            if(len < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            if(len < 0) {
+                perror("Aborting. Reading the script failed");
+                failed++;
+                break;
+            }
+            if(len == 0) { //a last line may lack its newline
+                eof = 1;
+                if(script.len) outbuf_append(&script, "\n", 1);
+                continue;
+            }
+            outbuf_append(&script, chunk, len);
             continue;
         }
 
-        printf("Name: %s\n"
-               "Pid: %d\n"
-               "State: %c\n"
-               "Utime: %lf\n"
-               "Stime: %lf\n"
-               "Rss: %lu\n"
-               "Voluntary_ctxt_switches: %d\n"
-               "Nonvoluntary_ctxt_swtitches: %d\n\n",
-               ((subprogram *) node->val)->name,
-               (int) ( (subprogram *) node->val)->pid,
-               status,
-               utime,
-               stime,
-               rss,
-               voluntary_ctxt_switches,
-               nonvoluntary_ctxt_switches);
+        *end = 0;
+        char * line = script.data + start;
+        start = end - script.data + 1;
+        if(line[0] == '#') continue; //comment line
+        if(run_command(jobs, line) < 0) failed++;
+        if(++lines % 64 == 0) evloop_run_once(loop, 0);
     }
 
-end:
-    regfree(&expr);
-    xfree(buffer);
-
+    if(polled) evloop_remove(loop, fd);
+    outbuf_free(&script);
+    return failed;
 }
 
 
-/* Summary: Prints all programs that are running or have exited
- * Description: Prints two lists, ended and active programs
- * Takes:
- *        programs: linked list of all programs
+/* Summary: Mainloop for program input and command procesing 
+ * Description: Multiplexes terminal input, control socket clients
+ * (-s path) and child exits in one event loop, or runs a script with
+ * -f file (- for standard input). With a socket pman keeps serving after
+ * its own input ends, until exit or shutdown.
  */
-void check_execution(ADTlinkedlist * programs) {
-
-    pid_t pid = 1;
-    printf("Exited jobs\n"
-           "Pid   Name   Exit Reason\n");
+int main(int argc, char * argv[]) {
 
-    int exited = 0;
-
-    while(pid > 0 && programs->num ) {
+    const char * socket_path = NULL;
+    int arg = 1;
+    if(argc > 2 && strcmp(argv[1], "-s") == 0) {
+        socket_path = argv[2];
+        arg = 3;
+    }
 
-        int status = 0;
-        pid = waitpid(-1,&status,WNOHANG); // 0 on no child1
-        if(pid < 0) {
-            perror("Aborintg: A waitpid call failed");
-            break;
+    FILE * script = NULL;
+    if(argc - arg == 1 && strcmp(argv[arg], "-") == 0) {
+        script = stdin;
+    } else if(argc - arg == 2 && strcmp(argv[arg], "-f") == 0) {
+        script = strcmp(argv[arg + 1], "-") == 0 ? stdin : fopen(argv[arg + 1], "r");
+        if(!script) {
+            perror("Aborting. Opening the script failed");
+            return 2;
         }
+    } else if(argc != arg) {
+        fprintf(stderr, "usage: %s [-s socket] [-f script | -]\n", argv[0]);
+        return 2;
+    }
+    batch_mode = script != NULL;
 
-        if(pid > 0) { //exited child
-
-            subprogram comparison; //comparison val, compare function ignore name field
-            comparison.pid = pid;
-            int index = adtFindLinkedValue(programs,&comparison,compare_programs);
-
-            if(index < 0) {
-                fprintf(stderr,"WARNING: A waitpid call returned an unknown pid\n");
-                continue;
-            }
-
-            if(index >= 0) { //program exited
-
-                ADTlinkednode * node = adtPopLinkedNode(programs,index); //get node to print info
-                exited++;
-
-                if(WIFSIGNALED(status)) { //two casses
-                    printf("%d  %s  Killed\n", pid, ((subprogram *) node->val)->name);
-                } else if (WIFEXITED(status)) { //two casses
-                    printf("%d  %s  Exited\n", pid, ((subprogram *) node->val)->name);
-                } else {
-                    fprintf(stderr,"WARNING: got signal with no handaler(pid=%d)\n",pid);
-                }
-                free_node(node);
+    jobtable jobs;
+    adtInitiateHashTable(&jobs.active);
+    adtInitiateHashTable(&jobs.exited);
+    loop_jobs = &jobs;
 
-            }
-        }
+    struct rlimit limit; //thousands of jobs need thousands of pipes
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
 
+    evloop loop;
+    if(evloop_init(&loop) < 0) {
+        perror("Aborting. Creating the event loop failed");
+        return 1;
     }
+    main_loop = &loop;
 
-    printf("Newly finished jobs: %d\n\n",exited);
+    sigset_t mask; //SIGCHLD is only delivered through the signalfd
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if(sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        perror("Aborting. Blocking SIGCHLD failed");
+        return 1;
+    }
+    int sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(sigfd < 0 || evloop_add(&loop, sigfd, EPOLLIN, on_sigchld, &jobs) < 0) {
+        perror("Aborting. Watching for child exits failed");
+        return 1;
+    }
 
-    printf("Background Jobs\n"
-           "Pid    Name\n");
+    capture_init(&loop);
+    events_init(&loop, &jobs);
+    watchdog_init(&loop, &jobs);
 
-    ADTlinkednode * node = programs->head;
-    while(node) {
-        subprogram * program = (subprogram *) node->val;
-        printf("%d  %s\n", program->pid, program->name);
-        node = node->next;
+    if(socket_path && control_listen(&loop, socket_path, run_control_command) < 0) {
+        perror("Aborting. Listening on the control socket failed");
+        return 1;
     }
 
-    printf("Total background jobs: %d\n", programs->num);
-}
-
+    int failed = 0;
+    if(batch_mode) {
+        failed = run_batch(&jobs, &loop, script);
+        if(script != stdin) fclose(script);
+        while(running && queue_busy()) { //the script ended, finish its queued jobs
+            if(evloop_run_once(&loop, -1) < 0) {
+                perror("Aborting. Waiting for events failed");
+                break;
+            }
+        }
+        while(running && control_active()) { //serve clients until shutdown
+            if(evloop_run_once(&loop, -1) < 0) {
+                perror("Aborting. Waiting for events failed");
+                break;
+            }
+        }
+    } else {
+        int stdin_polled = 1; //regular files can not be polled, they are always readable
+        if(evloop_add(&loop, STDIN_FILENO, EPOLLIN, on_stdin, NULL) < 0) {
+            if(errno != EPERM) {
+                perror("Aborting. Watching for input failed");
+                return 1;
+            }
+            stdin_polled = 0;
+        }
 
+        rl_callback_handler_install(prompt, handle_line);
 
-/* Summary: Mainloop for program input and command procesing 
- * Description: Implements commands from assignment
- */
-int main() {
-
-    ADTlinkedlist programs; //linked list for subprograms
-    adtInitiateLinkedList(&programs); 
-
-    while(1) {
-        char * input = NULL;
-        input = readline("PMan:  > ");
-
-        if ( input) {
-            char * * tokens =  get_tokens(input);
-            if(tokens) {
-                if(strcmp(tokens[0], "bg") == 0) {
-                    if( tokens[1] == NULL) {
-                        printf("Program not provided\nusage: bg program [arg1 arg2...]\n");
-                    } else {
-                        create_process(&programs, tokens + 1);
-                    }
-                } else if(strcmp(tokens[0],"bglist") == 0) {
-                    if( tokens[1] == NULL) {
-                        check_execution(&programs);
-                    } else {
-                        printf("Additional values provided to bglist, should be none\nusage: bglist");
-                    }
-
-                } else if(strcmp(tokens[0],"bgkill") == 0) { //ERROR: Process 1245 does not exist.
-                    if( tokens[1] == NULL) {
-                        printf("No pid provided\nusage: bgkill pid1 [pid2...]\n");
-                    } else {
-                        send_signal(&programs,tokens+1, SIGKILL);
-                    }
-                } else if(strcmp(tokens[0],"bgstop") == 0) {
-                    if( tokens[1] == NULL) {
-                        printf("No pid provided\nusage: bgstop pid1 [pid2...]\n");
-                    } else {
-                        send_signal(&programs,tokens+1, SIGSTOP);
-                    }
-                } else if(strcmp(tokens[0],"bgstart") == 0) {
-                    if( tokens[1] == NULL) {
-                        printf("No pid provided\nusage: bgstart pid1 [pid2...]\n");
-                    } else {
-                        send_signal(&programs,tokens+1, SIGCONT);
-                    }
-                } else if(strcmp(tokens[0],"pstat") == 0) {
-
-                    if( tokens[1] == NULL) {
-                        printf("No program id provided\nusage: pstat pid1 [pid2...]\n");
-                    } else {
-                        print_stats(&programs,tokens+1);
-                    }
-                } else if(strcmp(tokens[0],"help") == 0) {
-                    printf("Function            Command:\n"
-                           "Start New Program - bg program [arg1 arg2...]\n"
-                           "List Program      - bglist\n"
-                           "Stats for Program - pstat pid1 [pid2...]\n"
-                           "Kill Program      - bgkill pid1 [pid2...]\n"
-                           "Stop Program      - bgstop pid1 [pid2...]\n"
-                           "Resume Progam     - bgstart pid1 [pid2...]\n");
-                } else if(strcmp(tokens[0],"exit") == 0) {
-                    free_tokens(tokens);
-                    xfree(input);
-                    break;
-
-                } else {
-                    printf("Unknown command: %s\n", input);
-                }
-                free_tokens(tokens);
+        while(running) {
+            if(evloop_run_once(&loop, stdin_polled || !input_open ? -1 : 0) < 0) {
+                perror("Aborting. Waiting for events failed");
+                break;
             }
-            xfree(input);
+            if(!stdin_polled && input_open && running) on_stdin(STDIN_FILENO, EPOLLIN, NULL);
         }
+        if(ptop_timer_fd >= 0) rl_deprep_terminal(); //stopped by a shutdown from a client
+        else if(input_open) rl_callback_handler_remove();
     }
 
 
     printf("Exiting pman. All background proceses will be left in current state.\n");
-    while(programs.num > 0) { //cleanup all nodes
-        ADTlinkednode * node = adtPopLinkedNode(&programs,0);
-        free_node(node);
+    queue_stats queue;
+    queue_get_stats(&queue);
+    if(queue.queued) fprintf(stderr, "pman: %d queued job(s) were not started\n", queue.queued);
+    queue_free();
+    events_stop();
+    watchdog_free();
+    proctree_free();
+    ADThashtable * tables[] = {&jobs.active, &jobs.exited};
+    int i;
+    for(i = 0; i < 2; i++) {
+        while(tables[i]->num > 0) { //cleanup all nodes
+            ADThashnode * node = adtPopHashNode(tables[i],tables[i]->head->key);
+            free_node(node);
+        }
+        adtFreeHashTable(tables[i]);
     }
+    job_free_pool();
+    group_free_all();
+    if(ptop_rows) {
+        xfree(ptop_rows);
+        xfree(ptop_pids);
+        xfree(ptop_stats);
+        xfree(ptop_ok);
+    }
+    control_close();
+    evloop_close(&loop);
+    close(sigfd);
 
-    return 0;
+    fflush(stdout);
+    if(failed) fprintf(stderr, "pman: %d command(s) failed\n", failed);
+    return failed ? 1 : 0;
 }
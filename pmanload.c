@@ -0,0 +1,209 @@
+/* Load generator for the pman control socket. Build with "make load"
+ * Opens several clients that pipeline a window of commands each, then
+ * reports throughput and p50/p99/max reply latency.
+ * usage: pmanload socket [-c clients] [-n commands] [-w window] [command...] */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "utils.h"
+
+#define LOAD_CLIENTS_MAX 1024
+
+/* Struct for one client connection */
+typedef struct load_client {
+    int fd;
+    int sent; //commands written
+    int received; //replies read
+    double * sent_at; //send time of each command in the window, by command number
+    char * in; //reply bytes not yet parsed
+    int in_len;
+    int in_size;
+    int out_pos; //bytes of the current write batch already sent
+    int out_len;
+    char * out;
+} load_client;
+
+static int compare_doubles(const void * val1, const void * val2) {
+    double d1 = *(const double *) val1;
+    double d2 = *(const double *) val2;
+    return (d1 > d2) - (d1 < d2);
+}
+
+/* Connects to the socket at path, -1 on failure */
+static int connect_socket(const char * path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) return -1;
+    if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Parses complete replies of a client, recording their latency
+ * Returns: number of ERR replies parsed */
+static int parse_replies(load_client * client, int window, double * latencies, int * num_latencies) {
+    int errors = 0;
+    int pos = 0;
+    while(1) {
+        char * end = memchr(client->in + pos, '\n', client->in_len - pos);
+        if(!end) break;
+        int len = 0;
+        int err = strncmp(client->in + pos, "ERR ", 4) == 0;
+        if(!err && strncmp(client->in + pos, "OK ", 3) != 0) {
+            fprintf(stderr, "pmanload: malformed reply\n");
+            exit(1);
+        }
+        len = atoi(client->in + pos + (err ? 4 : 3));
+        int body = end - client->in + 1;
+        if(client->in_len - body < len) break; //body not complete yet
+
+        latencies[(*num_latencies)++] = monotonic_seconds() - client->sent_at[client->received % window];
+        client->received++;
+        errors += err;
+        pos = body + len;
+    }
+    memmove(client->in, client->in + pos, client->in_len - pos);
+    client->in_len -= pos;
+    return errors;
+}
+
+int main(int argc, char * argv[]) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s socket [-c clients] [-n commands] [-w window] [command...]\n", argv[0]);
+        return 2;
+    }
+    const char * path = argv[1];
+    int num_clients = 4;
+    int commands = 100000; //per client
+    int window = 64;
+    char command[4096] = "jobpool";
+
+    int arg = 2;
+    for(; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        int value = extract_pid(argv[arg + 1]);
+        if(strcmp(argv[arg], "-c") == 0 && value > 0 && value <= LOAD_CLIENTS_MAX) num_clients = value;
+        else if(strcmp(argv[arg], "-n") == 0 && value > 0) commands = value;
+        else if(strcmp(argv[arg], "-w") == 0 && value > 0) window = value;
+        else {
+            fprintf(stderr, "pmanload: invalid option %s %s\n", argv[arg], argv[arg + 1]);
+            return 2;
+        }
+    }
+    if(arg < argc) { //the rest is the command
+        command[0] = 0;
+        for(; arg < argc; arg++) {
+            if(strlen(command) + strlen(argv[arg]) + 2 > sizeof(command)) break;
+            if(command[0]) strcat(command, " ");
+            strcat(command, argv[arg]);
+        }
+    }
+    strcat(command, "\n");
+    int command_len = strlen(command);
+
+    load_client * clients = xmalloc(sizeof(load_client) * num_clients);
+    struct pollfd * fds = xmalloc(sizeof(struct pollfd) * num_clients);
+    int i;
+    for(i = 0; i < num_clients; i++) {
+        load_client * client = &clients[i];
+        client->fd = connect_socket(path);
+        if(client->fd < 0) {
+            perror("pmanload: connecting to the socket failed");
+            return 1;
+        }
+        client->sent = client->received = 0;
+        client->sent_at = xmalloc(sizeof(double) * window);
+        client->in_size = 1 << 16;
+        client->in = xmalloc(client->in_size);
+        client->in_len = 0;
+        client->out = xmalloc(command_len * window);
+        client->out_pos = client->out_len = 0;
+    }
+
+    int total = commands * num_clients;
+    double * latencies = xmalloc(sizeof(double) * total);
+    int num_latencies = 0;
+    int errors = 0;
+    int done = 0;
+    double start = monotonic_seconds();
+
+    while(done < num_clients) {
+        for(i = 0; i < num_clients; i++) {
+            load_client * client = &clients[i];
+            fds[i].fd = client->received < commands ? client->fd : -1;
+            fds[i].events = POLLIN;
+            if(client->out_pos == client->out_len) { //start a batch filling the window
+                client->out_pos = client->out_len = 0;
+                double now = monotonic_seconds();
+                while(client->sent < commands && client->sent - client->received < window) {
+                    memcpy(client->out + client->out_len, command, command_len);
+                    client->out_len += command_len;
+                    client->sent_at[client->sent++ % window] = now;
+                }
+            }
+            if(client->out_pos < client->out_len) fds[i].events |= POLLOUT;
+        }
+
+        if(poll(fds, num_clients, -1) < 0) {
+            if(errno == EINTR) continue;
+            perror("pmanload: poll failed");
+            return 1;
+        }
+
+        for(i = 0; i < num_clients; i++) {
+            load_client * client = &clients[i];
+            if(fds[i].revents & POLLOUT) {
+                ssize_t ret = write(client->fd, client->out + client->out_pos, client->out_len - client->out_pos);
+                if(ret > 0) client->out_pos += ret;
+            }
+            if(fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                if(client->in_len == client->in_size) {
+                    client->in_size *= 2;
+                    client->in = xrealloc(client->in, client->in_size);
+                }
+                ssize_t ret = read(client->fd, client->in + client->in_len, client->in_size - client->in_len);
+                if(ret <= 0) {
+                    fprintf(stderr, "pmanload: pman closed a connection\n");
+                    return 1;
+                }
+                client->in_len += ret;
+                errors += parse_replies(client, window, latencies, &num_latencies);
+                if(client->received == commands) done++;
+            }
+        }
+    }
+    double elapsed = monotonic_seconds() - start;
+
+    qsort(latencies, num_latencies, sizeof(double), compare_doubles);
+    int p99 = (int) (num_latencies * 0.99) < num_latencies ? (int) (num_latencies * 0.99) : num_latencies - 1;
+    printf("Command: %s"
+           "Clients: %d, window: %d, commands: %d, errors: %d\n"
+           "Elapsed: %.3f s, throughput: %.0f commands/s\n"
+           "Latency (us): p50 %.2f, p99 %.2f, max %.2f\n",
+           command, num_clients, window, num_latencies, errors, elapsed, num_latencies / elapsed,
+           latencies[num_latencies / 2] * 1e6, latencies[p99] * 1e6, latencies[num_latencies - 1] * 1e6);
+
+    for(i = 0; i < num_clients; i++) {
+        close(clients[i].fd);
+        xfree(clients[i].sent_at);
+        xfree(clients[i].in);
+        xfree(clients[i].out);
+    }
+    xfree(latencies);
+    xfree(fds);
+    xfree(clients);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,362 @@
+/* /proc parser implementation code */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "metrics.h"
+#include "procstat.h"
+
+#define PROCSTAT_MAX_THREADS 8
+#define PROCSTAT_CHUNK 16 //pids a thread takes at once
+#define PROCSTAT_MIN_PARALLEL 64 //smaller batches are read on the caller only
+
+/* Parses a decimal number starting at *pos (leading '-' allowed), stops at
+ * end or the first non digit. Moves *pos past the number and any spaces
+ * Returns -1 if there was no number. 0 otherwise
+ * */
+static int parse_number(const char * * pos, const char * end, long long * value) {
+    const char * p = *pos;
+    int negative = 0;
+    if(p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    if(p >= end || *p < '0' || *p > '9') return -1;
+
+    unsigned long long num = 0;
+    while(p < end && *p >= '0' && *p <= '9') {
+        num = num * 10 + (*p - '0');
+        p++;
+    }
+    while(p < end && (*p == ' ' || *p == '\t')) p++;
+
+    *value = negative ? -(long long) num : (long long) num;
+    *pos = p;
+    return 0;
+}
+
+/* Parse the contents of a /proc/pid/stat file (len bytes of buffer)
+ * Returns -1 if the contents are malformed. 0 otherwise
+ * */
+int procstat_parse_stat(const char * buffer, int len, procstat * stats) {
+    const char * end = buffer + len;
+    const char * pos = buffer;
+    long long value = 0;
+
+    if(parse_number(&pos, end, &value) < 0) return -1;
+    stats->pid = (pid_t) value;
+
+    //comm is between the first '(' and the last ')', it may contain both
+    const char * close = end - 1;
+    while(close > pos && *close != ')') close--;
+    if(pos >= end || *pos != '(' || close <= pos) return -1;
+    int comm_len = close - pos - 1;
+    if(comm_len >= PROCSTAT_COMM_SIZE) comm_len = PROCSTAT_COMM_SIZE - 1;
+    memcpy(stats->comm, pos + 1, comm_len);
+    stats->comm[comm_len] = 0;
+
+    pos = close + 1;
+    while(pos < end && *pos == ' ') pos++;
+    if(pos >= end) return -1;
+    stats->state = *pos++;
+    while(pos < end && *pos == ' ') pos++;
+
+    //numeric fields, numbered as in proc(5)
+    int field;
+    for(field = 4; field <= 41; field++) {
+        if(parse_number(&pos, end, &value) < 0) return -1;
+        switch(field) {
+        case 4: stats->ppid = (pid_t) value; break;
+        case 5: stats->pgrp = (pid_t) value; break;
+        case 14: stats->utime = (unsigned long) value; break;
+        case 15: stats->stime = (unsigned long) value; break;
+        case 19: stats->nice = (long) value; break;
+        case 20: stats->num_threads = (long) value; break;
+        case 22: stats->starttime = (unsigned long long) value; break;
+        case 23: stats->vsize = (unsigned long) value; break;
+        case 24: stats->rss = (long) value; break;
+        case 39: stats->processor = (int) value; break;
+        case 41: stats->policy = (int) value; break;
+        }
+    }
+
+    return 0;
+}
+
+/* Status keys parsed by procstat_parse_status */
+static const char voluntary_key[] = "voluntary_ctxt_switches:";
+static const char nonvoluntary_key[] = "nonvoluntary_ctxt_switches:";
+static const char cpus_key[] = "Cpus_allowed_list:";
+static const char mems_key[] = "Mems_allowed_list:";
+
+#define STATUS_FIELDS 3 //fields every status file has, Mems_allowed_list is optional
+
+/* Checks if the line at pos starts with key, moves pos past key and spaces */
+static int match_key(const char * * pos, const char * end, const char * key, int key_len) {
+    if(end - *pos < key_len || memcmp(*pos, key, key_len) != 0) return 0;
+    const char * p = *pos + key_len;
+    while(p < end && (*p == ' ' || *p == '\t')) p++;
+    *pos = p;
+    return 1;
+}
+
+/* Copies the rest of the line at pos into list, cut to fit */
+static void copy_list(const char * pos, const char * end, char * list) {
+    int len = end - pos;
+    if(len >= PROCSTAT_LIST_SIZE) len = PROCSTAT_LIST_SIZE - 1;
+    memcpy(list, pos, len);
+    list[len] = 0;
+}
+
+/* Parse complete lines of a /proc/pid/status file (len bytes of buffer),
+ * can be called once per chunk of lines
+ * Returns number of fields found
+ * */
+int procstat_parse_status(const char * buffer, int len, procstat * stats) {
+    const char * end = buffer + len;
+    const char * pos = buffer;
+    int found = 0;
+    long long value = 0;
+
+    while(pos < end) {
+        const char * line_end = memchr(pos, '\n', end - pos);
+        if(!line_end) line_end = end;
+
+        switch(*pos) { //first letter avoids comparing most lines
+        case 'v':
+            if(match_key(&pos, line_end, voluntary_key, sizeof(voluntary_key) - 1)
+               && parse_number(&pos, line_end, &value) == 0) {
+                stats->voluntary_ctxt_switches = (long) value;
+                found++;
+            }
+            break;
+        case 'n':
+            if(match_key(&pos, line_end, nonvoluntary_key, sizeof(nonvoluntary_key) - 1)
+               && parse_number(&pos, line_end, &value) == 0) {
+                stats->nonvoluntary_ctxt_switches = (long) value;
+                found++;
+            }
+            break;
+        case 'C':
+            if(match_key(&pos, line_end, cpus_key, sizeof(cpus_key) - 1)) {
+                copy_list(pos, line_end, stats->cpus_allowed);
+                found++;
+            }
+            break;
+        case 'M':
+            if(match_key(&pos, line_end, mems_key, sizeof(mems_key) - 1)) copy_list(pos, line_end, stats->mems_allowed);
+            break;
+        }
+
+        pos = line_end + 1;
+    }
+
+    return found;
+}
+
+/* Opens /proc/pid/name, returns the fd or -1 */
+static int open_proc_file(pid_t pid, const char * name) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int) pid, name);
+    int fd;
+    do {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    } while(fd < 0 && errno == EINTR);
+    return fd;
+}
+
+/* Read /proc/pid/stat into stats, using buffer of size bytes for io
+ * Returns -1 on failure (errno set when the read failed). 0 otherwise
+ * */
+int procstat_read_stat(pid_t pid, procstat * stats, char * buffer, int size) {
+    unsigned long long start = metrics_now();
+    int fd = open_proc_file(pid, "stat");
+    if(fd < 0) return -1;
+
+    int len = 0;
+    ssize_t bytes_read;
+    do { //proc files must be read all at once, one read normally does it
+        bytes_read = read(fd, buffer + len, size - len);
+        if(bytes_read > 0) len += bytes_read;
+    } while((bytes_read > 0 && len < size) || (bytes_read < 0 && errno == EINTR));
+    close(fd);
+    metrics_phase_record(PHASE_PROC_READ, start);
+
+    if(bytes_read < 0) return -1;
+    errno = 0;
+    start = metrics_now();
+    int ret = procstat_parse_stat(buffer, len, stats);
+    metrics_phase_record(PHASE_PARSE, start);
+    return ret;
+}
+
+/* Read /proc/pid/status into stats, using buffer of size bytes for io
+ * Returns -1 on failure (errno set when the read failed). 0 otherwise
+ * */
+int procstat_read_status(pid_t pid, procstat * stats, char * buffer, int size) {
+    unsigned long long start = metrics_now();
+    unsigned long long parsing = 0; //ns spent parsing between reads, left out of the read time
+    int fd = open_proc_file(pid, "status");
+    if(fd < 0) return -1;
+
+    int len = 0; //bytes carried over from an incomplete line
+    int found = 0;
+    stats->mems_allowed[0] = 0;
+    ssize_t bytes_read;
+    while(1) {
+        bytes_read = read(fd, buffer + len, size - len);
+        if(bytes_read < 0 && errno == EINTR) continue;
+        if(bytes_read <= 0) break;
+        len += bytes_read;
+
+        char * last = memrchr(buffer, '\n', len);
+        if(!last) { //one line bigger than the buffer, none of ours are
+            len = 0;
+            continue;
+        }
+        int complete = last - buffer + 1;
+        unsigned long long parse_start = metrics_now();
+        found += procstat_parse_status(buffer, complete, stats);
+        parsing += metrics_now() - parse_start;
+        len -= complete;
+        memmove(buffer, buffer + complete, len);
+    }
+    if(bytes_read == 0 && len) found += procstat_parse_status(buffer, len, stats);
+    close(fd);
+    metrics_phase_record(PHASE_PROC_READ, start + parsing);
+    metrics_phase_record(PHASE_PARSE, metrics_now() - parsing);
+
+    if(bytes_read < 0) return -1;
+    errno = 0;
+    return found == STATUS_FIELDS ? 0 : -1;
+}
+
+/* Read both stat and status of pid into stats, using buffer of size bytes for io
+ * Returns -1 on failure. 0 otherwise
+ * */
+int procstat_read(pid_t pid, procstat * stats, char * buffer, int size) {
+    if(procstat_read_stat(pid, stats, buffer, size) < 0) return -1;
+    return procstat_read_status(pid, stats, buffer, size);
+}
+
+
+/* Worker pool for procstat_read_many. Workers sleep until a new batch
+ * generation starts, then take chunks of pids until the batch is empty */
+static int pool_threads = 0; //0 until first use, then the configured count
+static int pool_started = 0; //workers running, pool_threads - 1 (the caller works too)
+static pthread_t pool_workers[PROCSTAT_MAX_THREADS];
+static unsigned int pool_seen[PROCSTAT_MAX_THREADS]; //last generation each worker ran
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static unsigned int pool_generation = 0;
+static int pool_busy = 0; //workers still on the current batch
+
+static struct {
+    const pid_t * pids;
+    procstat * stats;
+    int * ok;
+    int num;
+    int next; //next pid to take, atomic
+    int read; //successful reads, atomic
+} batch;
+
+/* Read chunks of the current batch until none are left */
+static void read_batch(void) {
+    char buffer[PROCSTAT_BUFFER_SIZE];
+    int read = 0;
+    while(1) {
+        int start = __atomic_fetch_add(&batch.next, PROCSTAT_CHUNK, __ATOMIC_RELAXED);
+        if(start >= batch.num) break;
+        int end = start + PROCSTAT_CHUNK < batch.num ? start + PROCSTAT_CHUNK : batch.num;
+        int i;
+        for(i = start; i < end; i++) {
+            batch.ok[i] = procstat_read(batch.pids[i], &batch.stats[i], buffer, sizeof(buffer)) == 0;
+            read += batch.ok[i];
+        }
+    }
+    __atomic_fetch_add(&batch.read, read, __ATOMIC_RELAXED);
+}
+
+/* Worker thread body, arg is the worker index */
+static void * pool_worker(void * arg) {
+    int index = (int) (long) arg;
+    while(1) {
+        pthread_mutex_lock(&pool_lock);
+        while(pool_generation == pool_seen[index]) pthread_cond_wait(&pool_start, &pool_lock);
+        pool_seen[index] = pool_generation;
+        int idle = index >= pool_threads - 1; //thread count was lowered since it started
+        pthread_mutex_unlock(&pool_lock);
+
+        if(!idle) read_batch();
+
+        pthread_mutex_lock(&pool_lock);
+        if(--pool_busy == 0) pthread_cond_signal(&pool_done);
+        pthread_mutex_unlock(&pool_lock);
+    }
+    return NULL;
+}
+
+/* Set the number of threads procstat_read_many spreads reads over,
+ * 1 reads on the calling thread only. Defaults to the online cpus (max 8)
+ * */
+void procstat_set_threads(int threads) {
+    if(threads < 1) threads = 1;
+    if(threads > PROCSTAT_MAX_THREADS) threads = PROCSTAT_MAX_THREADS;
+    pthread_mutex_lock(&pool_lock);
+    pool_threads = threads; //workers beyond it stay idle, missing ones start on demand
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* Threads procstat_read_many uses */
+int procstat_get_threads(void) {
+    if(!pool_threads) procstat_set_threads(sysconf(_SC_NPROCESSORS_ONLN));
+    return pool_threads;
+}
+
+/* Read stat and status of num pids, spread over the worker threads
+ * stats[i] and ok[i] receive the result for pids[i], ok[i] is 0 on failure
+ * Returns number of pids read successfully
+ * */
+int procstat_read_many(const pid_t * pids, procstat * stats, int * ok, int num) {
+    int threads = procstat_get_threads();
+
+    batch.pids = pids;
+    batch.stats = stats;
+    batch.ok = ok;
+    batch.num = num;
+    batch.next = 0;
+    batch.read = 0;
+
+    if(threads == 1 || num < PROCSTAT_MIN_PARALLEL) {
+        read_batch();
+        return batch.read;
+    }
+
+    while(pool_started < threads - 1) {
+        pool_seen[pool_started] = pool_generation;
+        if(pthread_create(&pool_workers[pool_started], NULL, pool_worker, (void *) (long) pool_started) != 0) break;
+        pthread_detach(pool_workers[pool_started]);
+        pool_started++;
+    }
+
+    pthread_mutex_lock(&pool_lock); //wake the workers, then work alongside them
+    pool_busy = pool_started;
+    pool_generation++;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_lock);
+
+    read_batch();
+
+    pthread_mutex_lock(&pool_lock);
+    while(pool_busy > 0) pthread_cond_wait(&pool_done, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+
+    return batch.read;
+}
@@ -0,0 +1,77 @@
+/* /proc parser header. Single pass parsing of /proc/pid/stat and
+ * /proc/pid/status into a procstat, reading into a caller owned buffer
+ * so nothing is allocated per pid */
+
+#ifndef _PROCSTAT_H
+#define _PROCSTAT_H
+
+#include <sys/types.h>
+
+#define PROCSTAT_BUFFER_SIZE 4096 //enough for any stat file, status is read in chunks
+#define PROCSTAT_COMM_SIZE 64
+#define PROCSTAT_LIST_SIZE 128 //cpu and node lists, longer ones are cut
+
+typedef struct procstat {
+    //taken from /proc/pid/stat
+    pid_t pid;
+    char comm[PROCSTAT_COMM_SIZE]; //may contain spaces and parens
+    char state;
+    pid_t ppid;
+    pid_t pgrp;
+    unsigned long utime; //clock ticks
+    unsigned long stime; //clock ticks
+    long nice;
+    long num_threads;
+    unsigned long long starttime; //clock ticks after boot
+    unsigned long vsize; //bytes
+    long rss; //pages
+    int processor; //cpu last run on
+    int policy; //scheduling policy, SCHED_OTHER and so on
+    //taken from /proc/pid/status
+    long voluntary_ctxt_switches;
+    long nonvoluntary_ctxt_switches;
+    char cpus_allowed[PROCSTAT_LIST_SIZE]; //affinity as a list like 0-3,8
+    char mems_allowed[PROCSTAT_LIST_SIZE]; //NUMA nodes, empty when the kernel has no cpusets
+} procstat;
+
+/* Parse the contents of a /proc/pid/stat file (len bytes of buffer)
+ * Returns -1 if the contents are malformed. 0 otherwise
+ * */
+int procstat_parse_stat(const char * buffer, int len, procstat * stats);
+
+/* Parse complete lines of a /proc/pid/status file (len bytes of buffer),
+ * can be called once per chunk of lines
+ * Returns number of fields found
+ * */
+int procstat_parse_status(const char * buffer, int len, procstat * stats);
+
+/* Read /proc/pid/stat into stats, using buffer of size bytes for io
+ * Returns -1 on failure (errno set when the read failed). 0 otherwise
+ * */
+int procstat_read_stat(pid_t pid, procstat * stats, char * buffer, int size);
+
+/* Read /proc/pid/status into stats, using buffer of size bytes for io
+ * Returns -1 on failure (errno set when the read failed). 0 otherwise
+ * */
+int procstat_read_status(pid_t pid, procstat * stats, char * buffer, int size);
+
+/* Read both stat and status of pid into stats, using buffer of size bytes for io
+ * Returns -1 on failure. 0 otherwise
+ * */
+int procstat_read(pid_t pid, procstat * stats, char * buffer, int size);
+
+/* Set the number of threads procstat_read_many spreads reads over,
+ * 1 reads on the calling thread only. Defaults to the online cpus (max 8)
+ * */
+void procstat_set_threads(int threads);
+
+/* Threads procstat_read_many uses */
+int procstat_get_threads(void);
+
+/* Read stat and status of num pids, spread over the worker threads
+ * stats[i] and ok[i] receive the result for pids[i], ok[i] is 0 on failure
+ * Returns number of pids read successfully
+ * */
+int procstat_read_many(const pid_t * pids, procstat * stats, int * ok, int num);
+
+#endif
@@ -0,0 +1,294 @@
+/* Process tree index implementation code */
+
+#define MEM_TAG MEM_JOBS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "proctree.h"
+#include "utils.h"
+
+#define PROCTREE_MAX_DEPTH 4096 //longer parent chains are taken as broken
+
+/* Struct for one indexed process */
+typedef struct tree_node {
+    ADThashnode node; //keyed by pid
+    pid_t ppid; //when first seen, descendants keep their job when orphaned
+    pid_t root; //job it descends from, 0 for none, -1 until resolved
+    unsigned long long starttime; //tells a reused pid apart, 0 until read
+    unsigned int seen; //scan that last listed it
+} tree_node;
+
+/* Struct for ordering members by parent */
+typedef struct tree_link {
+    pid_t parent;
+    pid_t pid;
+    int member; //index into the stats read
+} tree_link;
+
+static ADThashtable tree_index;
+static int built = 0; //the first scan read every process
+static unsigned int scan_number = 0;
+
+//descendants of jobs by root then pid, as of the last scan
+static tree_link * by_root = NULL; //parent holds the root
+static int by_root_num = 0;
+static int by_root_size = 0;
+
+static tree_node * find_node(pid_t pid) {
+    ADThashnode * node = adtFindHashNode(&tree_index, pid);
+    return node ? (tree_node *) node->val : NULL;
+}
+
+static void add_node(pid_t pid, pid_t ppid, pid_t root, unsigned long long starttime) {
+    tree_node * node = xmalloc(sizeof(tree_node));
+    adtInitiateHashNode(&node->node, pid, node);
+    node->ppid = ppid;
+    node->root = root;
+    node->starttime = starttime;
+    node->seen = scan_number;
+    adtAddHashNode(&tree_index, &node->node);
+}
+
+static void drop_node(pid_t pid) {
+    ADThashnode * node = adtPopHashNode(&tree_index, pid);
+    if(node) xfree(node->val);
+}
+
+static int is_job(jobtable * jobs, pid_t pid) {
+    return adtFindHashNode(&jobs->active, pid) || adtFindHashNode(&jobs->exited, pid);
+}
+
+/* Job pid descends from, found by walking up parents until a job or a
+ * resolved process
+ * Returns: the job's pid, 0 for none */
+static pid_t resolve_root(jobtable * jobs, pid_t pid) {
+    int depth;
+    for(depth = 0; pid > 1 && depth < PROCTREE_MAX_DEPTH; depth++) {
+        if(is_job(jobs, pid)) return pid;
+        tree_node * node = find_node(pid);
+        if(!node) return 0;
+        if(node->root >= 0) return node->root;
+        pid = node->ppid;
+    }
+    return 0;
+}
+
+/* Orders links by parent, then by pid */
+static int compare_links(const void * val1, const void * val2) {
+    const tree_link * l1 = val1;
+    const tree_link * l2 = val2;
+    if(l1->parent != l2->parent) return l1->parent < l2->parent ? -1 : 1;
+    return (l1->pid > l2->pid) - (l1->pid < l2->pid);
+}
+
+/* Summary: Brings the index up to date with /proc
+ * Description: Lists /proc once. Listed pids already indexed are only
+ * marked, new ones have their stat read and are linked to a job through
+ * their parents, indexed pids no longer listed are dropped. The first
+ * scan reads every process. Descendants are then sorted by job, for
+ * proctree_collect to find without walking the index
+ * Takes:
+ *        jobs: table of all programs, for the roots of new pids */
+void proctree_scan(jobtable * jobs) {
+    DIR * dir = opendir("/proc");
+    if(!dir) return;
+    scan_number++;
+
+    int size = 64;
+    int num_fresh = 0;
+    pid_t * fresh = xmalloc(sizeof(pid_t) * size);
+    char buffer[PROCSTAT_BUFFER_SIZE];
+    struct dirent * entry;
+    while((entry = readdir(dir))) {
+        if(entry->d_name[0] < '1' || entry->d_name[0] > '9') continue;
+        pid_t pid = atoi(entry->d_name);
+        tree_node * node = find_node(pid);
+        if(node) {
+            node->seen = scan_number;
+            continue;
+        }
+
+        procstat stats;
+        if(procstat_read_stat(pid, &stats, buffer, sizeof(buffer)) < 0) continue; //exited since the listing
+        add_node(pid, stats.ppid, -1, stats.starttime);
+        if(num_fresh == size) {
+            size *= 2;
+            fresh = xrealloc(fresh, sizeof(pid_t) * size);
+        }
+        fresh[num_fresh++] = pid;
+    }
+    closedir(dir);
+
+    ADThashnode * node;
+    ADThashnode * next;
+    for(node = tree_index.head; node; node = next) {
+        next = node->next;
+        if(((tree_node *) node->val)->seen != scan_number) drop_node(node->key);
+    }
+
+    int i;
+    for(i = 0; i < num_fresh; i++) find_node(fresh[i])->root = resolve_root(jobs, fresh[i]);
+    xfree(fresh);
+    built = 1;
+
+    if(by_root_size < tree_index.num) {
+        by_root_size = tree_index.num * 2;
+        by_root = by_root ? xrealloc(by_root, sizeof(tree_link) * by_root_size)
+                          : xmalloc(sizeof(tree_link) * by_root_size);
+    }
+    by_root_num = 0;
+    for(node = tree_index.head; node; node = node->next) {
+        pid_t root = ((tree_node *) node->val)->root;
+        if(root <= 0 || root == node->key) continue;
+        by_root[by_root_num].parent = root;
+        by_root[by_root_num++].pid = node->key;
+    }
+    qsort(by_root, by_root_num, sizeof(tree_link), compare_links);
+}
+
+/* Orders pids */
+static int compare_pid(const void * val1, const void * val2) {
+    pid_t p1 = *(const pid_t *) val1;
+    pid_t p2 = *(const pid_t *) val2;
+    return (p1 > p2) - (p1 < p2);
+}
+
+/* First link with parent in the sorted links, num if none */
+static int first_child(const tree_link * links, int num, pid_t parent) {
+    int low = 0;
+    int high = num;
+    while(low < high) {
+        int mid = (low + high) / 2;
+        if(links[mid].parent < parent) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+/* Summary: Collects a job and its live descendants after a scan
+ * Description: The descendants the last scan found are read together
+ * with procstat_read_many, so a command scans once for all its jobs.
+ * One that is gone, or whose start time shows its pid was reused, is
+ * dropped from the index. The tree is shaped by the current parents, a
+ * descendant whose parent is not in it hangs under the job
+ * Takes:
+ *        job: the job, running
+ *        members: set to the job then its descendants depth first, with
+ *                 fresh stats, free with xfree
+ * Returns: number of members, -1 if the job could not be read */
+int proctree_collect(subprogram * job, proctree_member * * members) {
+    int first = first_child(by_root, by_root_num, job->pid);
+    int last = first;
+    while(last < by_root_num && by_root[last].parent == job->pid) last++;
+
+    int num = 0;
+    pid_t * pids = xmalloc_tagged(sizeof(pid_t) * (last - first + 1), MEM_STATS);
+    pids[num++] = job->pid;
+    for(; first < last; first++) pids[num++] = by_root[first].pid;
+
+    procstat * stats = xmalloc_tagged(sizeof(procstat) * num, MEM_STATS);
+    int * ok = xmalloc_tagged(sizeof(int) * num, MEM_STATS);
+    procstat_read_many(pids, stats, ok, num);
+    if(!ok[0]) {
+        xfree(ok);
+        xfree(stats);
+        xfree(pids);
+        return -1;
+    }
+
+    //links of the live descendants, the job is the parent of orphans
+    tree_link * links = xmalloc_tagged(sizeof(tree_link) * num, MEM_STATS);
+    pid_t * live = xmalloc_tagged(sizeof(pid_t) * num, MEM_STATS);
+    int num_live = 0;
+    int i;
+    for(i = 1; i < num; i++) {
+        tree_node * tnode = find_node(pids[i]);
+        if(!tnode) continue; //dropped by an earlier collect of the same command
+        if(!ok[i] || (tnode->starttime && tnode->starttime != stats[i].starttime)) {
+            drop_node(pids[i]); //a reused pid is read as new by the next scan
+            continue;
+        }
+        tnode->starttime = stats[i].starttime;
+        links[num_live].member = i;
+        links[num_live].pid = pids[i];
+        live[num_live++] = pids[i];
+    }
+    qsort(live, num_live, sizeof(pid_t), compare_pid);
+    for(i = 0; i < num_live; i++) {
+        pid_t parent = stats[links[i].member].ppid;
+        links[i].parent = bsearch(&parent, live, num_live, sizeof(pid_t), compare_pid) ? parent : job->pid;
+    }
+    qsort(links, num_live, sizeof(tree_link), compare_links);
+
+    //depth first from the job, every member is reached once through its parent
+    proctree_member * out = xmalloc_tagged(sizeof(proctree_member) * (num_live + 1), MEM_STATS);
+    int * stack = xmalloc_tagged(sizeof(int) * (num_live + 1), MEM_STATS); //indexes into stats
+    int * depths = xmalloc_tagged(sizeof(int) * (num_live + 1), MEM_STATS);
+    int top = 0;
+    int count = 0;
+    stack[top] = 0;
+    depths[top++] = 0;
+    while(top) {
+        top--;
+        int member = stack[top];
+        int depth = depths[top];
+        out[count].depth = depth;
+        out[count++].stats = stats[member];
+
+        pid_t pid = stats[member].pid;
+        int first = first_child(links, num_live, pid);
+        int last = first;
+        while(last < num_live && links[last].parent == pid) last++;
+        while(last-- > first) { //pushed in reverse so children come out in pid order
+            stack[top] = links[last].member;
+            depths[top++] = depth + 1;
+        }
+    }
+
+    xfree(depths);
+    xfree(stack);
+    xfree(live);
+    xfree(links);
+    xfree(ok);
+    xfree(stats);
+    xfree(pids);
+    *members = out;
+    return count;
+}
+
+/* A fork reported by events, root is the job parent belongs to or 0 */
+void proctree_forked(pid_t parent, pid_t child, pid_t root) {
+    if(!built) return; //the first scan will read it
+    drop_node(child);
+    tree_node * pnode = find_node(parent);
+    if(!root && pnode && pnode->root > 0) root = pnode->root;
+    add_node(child, parent, root, 0);
+}
+
+/* An exit reported by events */
+void proctree_exited(pid_t pid) {
+    drop_node(pid);
+}
+
+/* Forget which processes descend from root, its job is gone */
+void proctree_disown(pid_t root) {
+    if(!built) return;
+    ADThashnode * node;
+    for(node = tree_index.head; node; node = node->next) {
+        tree_node * tnode = (tree_node *) node->val;
+        if(tnode->root == root) tnode->root = 0;
+    }
+}
+
+/* Free the index */
+void proctree_free(void) {
+    while(tree_index.num) drop_node(tree_index.head->key);
+    adtFreeHashTable(&tree_index);
+    built = 0;
+    if(by_root) xfree(by_root);
+    by_root = NULL;
+    by_root_num = by_root_size = 0;
+}
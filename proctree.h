@@ -0,0 +1,46 @@
+/* Process tree index header. Every pid on the system is mapped to its
+ * parent and to the job it descends from, so the workers a job's script
+ * starts can be found without walking /proc each time. The first scan
+ * reads the ppid of every process, later scans list /proc and only read
+ * the pids they have not seen. Forks and exits from events update it
+ * between scans */
+
+#ifndef _PROCTREE_H
+#define _PROCTREE_H
+
+#include <sys/types.h>
+
+#include "jobs.h"
+#include "procstat.h"
+
+/* Struct for one process of a job's tree */
+typedef struct proctree_member {
+    int depth; //0 for the job, 1 for its children and processes it orphaned
+    procstat stats;
+} proctree_member;
+
+/* Bring the index up to date with /proc, reading only new pids. Called
+ * once per command, before proctree_collect for each of its jobs */
+void proctree_scan(jobtable * jobs);
+
+/* Summary: Collects a job and its live descendants found by the last scan
+ * Takes:
+ *        job: the job, running
+ *        members: set to the job then its descendants depth first, with
+ *                 fresh stats, free with xfree
+ * Returns: number of members, -1 if the job could not be read */
+int proctree_collect(subprogram * job, proctree_member * * members);
+
+/* A fork reported by events, root is the job parent belongs to or 0 */
+void proctree_forked(pid_t parent, pid_t child, pid_t root);
+
+/* An exit reported by events */
+void proctree_exited(pid_t pid);
+
+/* Forget which processes descend from root, its job is gone */
+void proctree_disown(pid_t root);
+
+/* Free the index */
+void proctree_free(void);
+
+#endif
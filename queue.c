@@ -0,0 +1,207 @@
+/* Job queue implementation code */
+
+#define MEM_TAG MEM_JOBS
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "output.h"
+#include "queue.h"
+#include "utils.h"
+
+/* Struct for a job waiting in the queue */
+typedef struct queue_entry {
+    struct queue_entry * next;
+    char * * args; //own tokens, freed with free_tokens
+    job_options options;
+} queue_entry;
+
+static queue_entry * head = NULL;
+static queue_entry * tail = NULL;
+static int queued = 0;
+static int running = 0;
+static int done = 0;
+static int failed = 0;
+static int limit = 0; //0 until set, then defaults to the online cpus
+
+//throughput is measured over the current or last busy period
+static double period_start = 0;
+static double period_end = 0; //0 while busy
+static int period_done = 0;
+
+/* Limit of running jobs */
+static int queue_limit(void) {
+    if(limit <= 0) {
+        limit = sysconf(_SC_NPROCESSORS_ONLN);
+        if(limit <= 0) limit = 1;
+    }
+    return limit;
+}
+
+/* Adds a job at the end of the queue, taking ownership of args */
+static void enqueue(char * * args, const job_options * options) {
+    if(!queued && !running) { //a new busy period
+        period_start = monotonic_seconds();
+        period_end = 0;
+        period_done = 0;
+    }
+
+    queue_entry * entry = xmalloc(sizeof(queue_entry));
+    entry->next = NULL;
+    entry->args = args;
+    entry->options = *options;
+    if(tail) tail->next = entry;
+    else head = entry;
+    tail = entry;
+    queued++;
+}
+
+/* Starts queued jobs until the limit is running */
+void queue_dispatch(jobtable * jobs) {
+    while(head && running < queue_limit()) {
+        queue_entry * entry = head;
+        head = entry->next;
+        if(!head) tail = NULL;
+        queued--;
+
+        int err = 0;
+        subprogram * job = start_job(jobs, entry->args, &entry->options, &err);
+        if(job) {
+            job->queued = 1;
+            running++;
+        } else { //may run between commands, so not part of any command output
+            fprintf(stderr, "pman: queued job %s failed to start: %s\n", entry->args[0], strerror(err));
+            failed++;
+        }
+        free_tokens(entry->args);
+        xfree(entry);
+    }
+
+    if(!queued && !running && period_start > 0 && period_end == 0) period_end = monotonic_seconds();
+}
+
+/* Counts a reaped job out of the queue, if the queue started it */
+void queue_reaped(subprogram * job) {
+    if(!job->queued) return;
+    job->queued = 0;
+    running--;
+    done++;
+    period_done++;
+    if(!WIFEXITED(job->status) || WEXITSTATUS(job->status) != 0) failed++;
+}
+
+/* Checks if the queue has jobs waiting or running */
+int queue_busy(void) {
+    return queued || running;
+}
+
+/* Fill stats with the current counters */
+void queue_get_stats(queue_stats * stats) {
+    stats->queued = queued;
+    stats->running = running;
+    stats->done = done;
+    stats->failed = failed;
+    stats->limit = queue_limit();
+    stats->throughput = 0;
+    if(period_start > 0) {
+        double elapsed = (period_end > 0 ? period_end : monotonic_seconds()) - period_start;
+        if(elapsed > 0) stats->throughput = period_done / elapsed;
+    }
+}
+
+/* Prints the counters of the queue */
+static void print_queue(void) {
+    queue_stats stats;
+    queue_get_stats(&stats);
+    if(out_get_format() != OUT_HUMAN) {
+        out_record("queue");
+        out_field_int("queued", stats.queued);
+        out_field_int("running", stats.running);
+        out_field_int("done", stats.done);
+        out_field_int("failed", stats.failed);
+        out_field_int("limit", stats.limit);
+        out_field_double("throughput", stats.throughput);
+        out_end_record();
+        return;
+    }
+    out_printf("Queue: %d queued, %d running, %d done, %d failed, limit %d, %.1f jobs/s\n",
+               stats.queued, stats.running, stats.done, stats.failed, stats.limit, stats.throughput);
+}
+
+/* Summary: Runs the bgqueue command
+ * Description: Queues one job, or one per line of a file, and starts as
+ * many as the limit allows. The rest start as running jobs are reaped.
+ * Without a program only sets the limit and prints the counters.
+ * Takes:
+ *       jobs: table of all subprograms
+ *       args: arguements after bgqueue
+ * Returns: -1 on failure, 0 otherwise
+ */
+int queue_command(jobtable * jobs, char * * args) {
+    if(args[0] && strcmp(args[0], "-j") == 0) {
+        int value = args[1] ? extract_pid(args[1]) : -1;
+        if(value <= 0) {
+            out_printf("Invalid limit, at least 1\nusage: bgqueue [-j N] [options] program [arg1 arg2...] | bgqueue [-j N] -f file\n");
+            return -1;
+        }
+        limit = value;
+        args += 2;
+    }
+
+    job_options options;
+    int used = parse_job_options(args, &options);
+    if(used < 0) return -1;
+    if(used && !args[used]) {
+        out_printf("Program not provided\nusage: bgqueue [-j N] [options] program [arg1 arg2...]\n");
+        return -1;
+    }
+    args += used;
+
+    if(args[0] && strcmp(args[0], "-f") == 0) {
+        if(!args[1] || args[2]) {
+            out_printf("One file expected\nusage: bgqueue [-j N] [options] -f file\n");
+            return -1;
+        }
+
+        FILE * fp = fopen(args[1], "r");
+        if(!fp) {
+            out_perror("Aborting. Opening the arguement file failed");
+            return -1;
+        }
+        char * line = NULL;
+        size_t line_size = 0;
+        while(getline(&line, &line_size, fp) > 0) {
+            char * * tokens = get_tokens(line);
+            if(!tokens) continue; //blank line
+            if(tokens[0][0] == '#') { //comment line
+                free_tokens(tokens);
+                continue;
+            }
+            enqueue(tokens, &options);
+        }
+        free(line); //allocated by getline
+        fclose(fp);
+    } else if(args[0]) {
+        enqueue(copy_tokens(args), &options);
+    }
+
+    queue_dispatch(jobs);
+    print_queue();
+    return 0;
+}
+
+/* Free all jobs still waiting */
+void queue_free(void) {
+    while(head) {
+        queue_entry * entry = head;
+        head = entry->next;
+        free_tokens(entry->args);
+        xfree(entry);
+    }
+    tail = NULL;
+    queued = 0;
+}
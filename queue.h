@@ -0,0 +1,39 @@
+/* Job queue header. bgqueue keeps job specs in a FIFO and runs at most a
+ * limit of them at once, the next one starts as soon as one is reaped */
+
+#ifndef _QUEUE_H
+#define _QUEUE_H
+
+#include "commands.h"
+#include "jobs.h"
+
+/* Struct for the counters of the queue */
+typedef struct queue_stats {
+    int queued; //waiting to start
+    int running;
+    int done; //reaped since pman started
+    int failed; //did not start, or exited with a non zero status or a signal
+    int limit;
+    double throughput; //jobs done per second while the queue was busy
+} queue_stats;
+
+/* Runs the bgqueue command with the arguements after bgqueue
+ * Returns: -1 on failure, 0 otherwise */
+int queue_command(jobtable * jobs, char * * args);
+
+/* Counts a reaped job out of the queue, if the queue started it */
+void queue_reaped(subprogram * job);
+
+/* Starts queued jobs until the limit is running */
+void queue_dispatch(jobtable * jobs);
+
+/* Checks if the queue has jobs waiting or running */
+int queue_busy(void);
+
+/* Fill stats with the current counters */
+void queue_get_stats(queue_stats * stats);
+
+/* Free all jobs still waiting */
+void queue_free(void);
+
+#endif
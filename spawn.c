@@ -0,0 +1,305 @@
+/* Process spawning implementation code */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "metrics.h"
+#include "spawn.h"
+
+extern char * * environ;
+
+static spawn_backend current_backend = SPAWN_POSIX;
+
+static const char * backend_names[] = {"fork", "vfork", "posix"};
+
+/* Takes a backend name (fork, vfork, posix)
+ * Return: the backend if valid, otherwise -1
+ * */
+int spawn_parse_backend(const char * name) {
+    int i;
+    for(i = 0; i < (int) (sizeof(backend_names) / sizeof(backend_names[0])); i++) {
+        if(strcmp(name, backend_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+/* Name of a backend, for printing */
+const char * spawn_backend_name(spawn_backend backend) {
+    return backend_names[backend];
+}
+
+/* Select the backend used by spawn_process */
+void spawn_set_backend(spawn_backend backend) {
+    current_backend = backend;
+}
+
+/* Backend currently used by spawn_process */
+spawn_backend spawn_get_backend(void) {
+    return current_backend;
+}
+
+/* Signal mask for children, pman's own mask without SIGCHLD
+ * (pman blocks it for its signalfd and the mask survives exec) */
+static void child_sigmask(sigset_t * mask) {
+    sigprocmask(SIG_BLOCK, NULL, mask);
+    sigdelset(mask, SIGCHLD);
+}
+
+/* Set options to the defaults, a child set up like pman itself */
+void spawn_init_options(spawn_options * options) {
+    options->pgid = -1;
+    options->procs_fd = -1;
+    options->out_fd = -1;
+    options->set_cpus = 0;
+    CPU_ZERO(&options->cpus);
+    options->node = -1;
+    options->set_nice = 0;
+    options->nice = 0;
+    options->policy = -1;
+}
+
+/* Whether options need code run in the child, which posix_spawn can not do */
+static int needs_child_setup(const spawn_options * options) {
+    return options && (options->procs_fd >= 0 || options->set_cpus || options->node >= 0
+                       || options->set_nice || options->policy >= 0);
+}
+
+/* Applies options in the child, only async signal safe calls
+ * Returns 0 on success, otherwise the errno of the failed call */
+static int child_setup(const spawn_options * options) {
+    if(!options) return 0;
+    if(options->pgid >= 0 && setpgid(0, options->pgid) < 0) return errno;
+    if(options->procs_fd >= 0 && write(options->procs_fd, "0", 1) < 0) return errno; //0 is the writer
+    if(options->out_fd >= 0 && (dup2(options->out_fd, STDOUT_FILENO) < 0
+                                || dup2(options->out_fd, STDERR_FILENO) < 0)) return errno;
+    if(options->set_cpus && sched_setaffinity(0, sizeof(options->cpus), &options->cpus) < 0) return errno;
+    if(options->node >= 0) { //raw syscall, libnuma is not needed for one mask
+        unsigned long nodes = 1UL << options->node;
+        if(syscall(SYS_set_mempolicy, MPOL_BIND, &nodes, sizeof(nodes) * 8) < 0) return errno;
+    }
+    if(options->policy >= 0) {
+        struct sched_param param = {.sched_priority = options->policy == SCHED_FIFO ? 1 : 0};
+        if(sched_setscheduler(0, options->policy, &param) < 0) return errno;
+    }
+    if(options->set_nice && setpriority(PRIO_PROCESS, 0, options->nice) < 0) return errno;
+    return 0;
+}
+
+/* Fork backend, start half. Uses the self-pipe trick to detect failures
+ * in exec, the child writes its errno to a close on exec pipe. With
+ * release_fd the child waits before exec until pman closes it */
+static pid_t spawn_fork_start(char * args[], const spawn_options * options, int * confirm_fd,
+                              int * release_fd, int * err) {
+    int pipes[2] = {-1, -1};
+    int hold[2] = {-1, -1};
+
+    if (pipe2(pipes, O_CLOEXEC) < 0) {
+        *err = errno;
+        return -1;
+    }
+    if (release_fd && pipe2(hold, O_CLOEXEC) < 0) {
+        *err = errno;
+        close(pipes[0]);
+        close(pipes[1]);
+        return -1;
+    }
+
+    sigset_t mask;
+    child_sigmask(&mask);
+
+    unsigned long long start = metrics_now();
+    pid_t child = fork();
+    if(child < 0) {
+        *err = errno;
+        close(pipes[0]);
+        close(pipes[1]);
+        if(release_fd) {
+            close(hold[0]);
+            close(hold[1]);
+        }
+        return -1;
+    } else if( child == 0 ) { //child action
+
+        close(pipes[0]);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+
+        int code = child_setup(options);
+        if(release_fd) { //wait for end of file, pman is done with the child
+            char byte;
+            close(hold[1]);
+            while(read(hold[0], &byte, 1) < 0 && errno == EINTR);
+        }
+        if(!code) {
+            execvp(args[0], args); //this will auto-close pipe if it dosen't return
+            code = errno;
+        }
+
+        //if something failed let parrent process know
+        if(write(pipes[1],&code,sizeof(code)) < 0) _exit(127);
+        _exit(127);
+    }
+
+    metrics_phase_record(PHASE_FORK, start);
+    //parent action. Set the group here too, so the next job can join it
+    //before this child ran, errors mean the child already did it
+    if(options && options->pgid >= 0) setpgid(child, options->pgid ? options->pgid : child);
+    close(pipes[1]);
+    *confirm_fd = pipes[0];
+    if(release_fd) {
+        close(hold[0]);
+        *release_fd = hold[1];
+    }
+    return child;
+}
+
+/* Collect the exec result of a child from spawn_start, closing confirm_fd
+ * Blocks until the exec finished, poll confirm_fd first to avoid that
+ * Returns 0 if exec succeded, -1 if it failed with err set (child is reaped)
+ * */
+int spawn_confirm(pid_t child, int confirm_fd, int * err) {
+    int code = 0;
+    ssize_t bytes_read;
+    unsigned long long start = metrics_now();
+    do { //this will return on exec or exec failure
+        bytes_read = read(confirm_fd,&code,sizeof(code));
+    } while(bytes_read < 0 && errno == EINTR);
+    if(bytes_read < 0) code = errno;
+    close(confirm_fd);
+    metrics_phase_record(PHASE_EXEC_CONFIRM, start);
+
+    if( bytes_read != 0) { //child failed to exec since it wrote to pipe
+        *err = code;
+        waitpid(child, NULL, 0); //collect it so it is never reported as a job
+        return -1;
+    }
+    return 0;
+}
+
+/* Vfork backend. The parent is suspended until the child execs or exits,
+ * so the child reports exec failures through shared memory */
+static pid_t spawn_vfork(char * args[], const spawn_options * options, int * err) {
+    volatile int exec_errno = 0;
+    sigset_t mask;
+    child_sigmask(&mask);
+
+    unsigned long long start = metrics_now();
+    pid_t child = vfork();
+    if(child < 0) {
+        *err = errno;
+        return -1;
+    } else if(child == 0) { //child action, only async signal safe calls
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        exec_errno = child_setup(options);
+        if(!exec_errno) {
+            execvp(args[0], args);
+            exec_errno = errno;
+        }
+        _exit(127);
+    }
+
+    metrics_phase_record(PHASE_FORK, start); //includes the exec, pman waits for it
+    if(exec_errno) { //parent action
+        *err = exec_errno;
+        waitpid(child, NULL, 0);
+        return -1;
+    }
+    return child;
+}
+
+/* Posix spawn backend. glibc reports exec failures as the return value
+ * and collects the failed child itself */
+static pid_t spawn_posix(char * args[], const spawn_options * options, int * err) {
+    posix_spawnattr_t attr;
+    pid_t child = -1;
+    int ret = posix_spawnattr_init(&attr);
+    if(ret) {
+        *err = ret;
+        return -1;
+    }
+
+    sigset_t mask;
+    child_sigmask(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    if(options && options->pgid >= 0) {
+        posix_spawnattr_setpgroup(&attr, options->pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if(options && options->out_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, options->out_fd, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, options->out_fd, STDERR_FILENO);
+    }
+
+    unsigned long long start = metrics_now();
+    ret = posix_spawnp(&child, args[0], &actions, &attr, args, environ);
+    metrics_phase_record(PHASE_FORK, start); //includes the exec, pman waits for it
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if(ret) {
+        *err = ret;
+        return -1;
+    }
+    return child;
+}
+
+/* Start args[0] with args, searching PATH, using the selected backend
+ * options may be NULL for the defaults. A cgroup or placement needs code
+ * in the child, so posix falls back to vfork for them
+ * Returns the pid of the child when exec succeded
+ * Returns -1 on failure, err set to the errno of the failed call
+ * */
+pid_t spawn_process(char * args[], const spawn_options * options, int * err) {
+    int confirm_fd = -1;
+    pid_t child = spawn_start(args, options, &confirm_fd, err);
+    if(child < 0 || confirm_fd < 0) return child;
+    if(spawn_confirm(child, confirm_fd, err) < 0) return -1;
+    return child;
+}
+
+/* Start args[0] like spawn_process, without waiting for the exec result
+ * when the backend allows it (only fork does, the others confirm at once)
+ * Returns the pid of the child, confirm_fd set to a fd that becomes readable
+ * once exec finished, or -1 if the exec already succeded
+ * Returns -1 on failure, err set to the errno of the failed call
+ * */
+pid_t spawn_start(char * args[], const spawn_options * options, int * confirm_fd, int * err) {
+    *err = 0;
+    *confirm_fd = -1;
+    switch(current_backend) {
+    case SPAWN_VFORK:
+        return spawn_vfork(args, options, err);
+    case SPAWN_POSIX:
+        if(needs_child_setup(options)) return spawn_vfork(args, options, err);
+        return spawn_posix(args, options, err);
+    default:
+        return spawn_fork_start(args, options, confirm_fd, NULL, err);
+    }
+}
+
+/* Start args[0] like spawn_start, always with the fork backend. The child
+ * waits before exec until release_fd is closed, so pman can set it up
+ * from outside first (counters enabled by the exec)
+ * Returns the pid of the child, confirm_fd and release_fd set
+ * Returns -1 on failure, err set to the errno of the failed call
+ * */
+pid_t spawn_start_held(char * args[], const spawn_options * options, int * confirm_fd, int * release_fd, int * err) {
+    *err = 0;
+    *confirm_fd = -1;
+    return spawn_fork_start(args, options, confirm_fd, release_fd, err);
+}
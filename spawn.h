@@ -0,0 +1,76 @@
+/* Process spawning header. Starts programs with a selectable backend,
+ * every backend reports exec failures back to the caller */
+
+#ifndef _PMAN_SPAWN_H
+#define _PMAN_SPAWN_H
+
+#include <sched.h>
+#include <sys/types.h>
+
+typedef enum spawn_backend {
+    SPAWN_FORK,  //fork + self-pipe, copies the page tables of pman
+    SPAWN_VFORK, //vfork, child borrows pman's memory until exec
+    SPAWN_POSIX  //posix_spawnp, CLONE_VFORK based in glibc
+} spawn_backend;
+
+/* Struct for the setup done in the child before exec */
+typedef struct spawn_options {
+    pid_t pgid; //-1 stays in pman's process group, 0 leads a new one, otherwise joins it
+    int procs_fd; //cgroup.procs of a cgroup to join, -1 for none
+    int out_fd; //stdout and stderr of the child, -1 keeps pman's
+    int set_cpus;
+    cpu_set_t cpus; //cpu affinity when set_cpus
+    int node; //NUMA node to bind memory to, -1 for none
+    int set_nice;
+    int nice;
+    int policy; //scheduling policy, -1 keeps pman's
+} spawn_options;
+
+/* Takes a backend name (fork, vfork, posix)
+ * Return: the backend if valid, otherwise -1
+ * */
+int spawn_parse_backend(const char * name);
+
+/* Name of a backend, for printing */
+const char * spawn_backend_name(spawn_backend backend);
+
+/* Select the backend used by spawn_process */
+void spawn_set_backend(spawn_backend backend);
+
+/* Backend currently used by spawn_process */
+spawn_backend spawn_get_backend(void);
+
+/* Set options to the defaults, a child set up like pman itself */
+void spawn_init_options(spawn_options * options);
+
+/* Start args[0] with args, searching PATH, using the selected backend
+ * options may be NULL for the defaults. A cgroup or placement needs code
+ * in the child, so posix falls back to vfork for them
+ * Returns the pid of the child when exec succeded
+ * Returns -1 on failure, err set to the errno of the failed call
+ * */
+pid_t spawn_process(char * args[], const spawn_options * options, int * err);
+
+/* Start args[0] like spawn_process, without waiting for the exec result
+ * when the backend allows it (only fork does, the others confirm at once)
+ * Returns the pid of the child, confirm_fd set to a fd that becomes readable
+ * once exec finished, or -1 if the exec already succeded
+ * Returns -1 on failure, err set to the errno of the failed call
+ * */
+pid_t spawn_start(char * args[], const spawn_options * options, int * confirm_fd, int * err);
+
+/* Start args[0] like spawn_start, always with the fork backend. The child
+ * waits before exec until release_fd is closed, so pman can set it up
+ * from outside first (counters enabled by the exec)
+ * Returns the pid of the child, confirm_fd and release_fd set
+ * Returns -1 on failure, err set to the errno of the failed call
+ * */
+pid_t spawn_start_held(char * args[], const spawn_options * options, int * confirm_fd, int * release_fd, int * err);
+
+/* Collect the exec result of a child from spawn_start, closing confirm_fd
+ * Blocks until the exec finished, poll confirm_fd first to avoid that
+ * Returns 0 if exec succeded, -1 if it failed with err set (child is reaped)
+ * */
+int spawn_confirm(pid_t child, int confirm_fd, int * err);
+
+#endif
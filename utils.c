@@ -1,38 +1,85 @@
 //* Utilities for memory management and parsing. All frees are callers responsability */
 
+#define MEM_TAG MEM_TOKENS
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <ctype.h>
+#include <string.h>
+#include <time.h>
 
 #include "utils.h"
 
+/* Header in front of every block, 16 bytes so the block keeps malloc's alignment */
+typedef struct mem_header {
+    size_t size;
+    size_t tag;
+} mem_header;
+
+static mem_stats mem_counters[MEM_TAGS + 1]; //the last one has the totals
+static const char * mem_tag_names[MEM_TAGS + 1] = {"other", "tokens", "jobs", "stats", "output", "capture", "total"};
+
+/* Counts size bytes in or out (negative) of tag and the totals */
+static void mem_count(size_t tag, long size, int allocs) {
+    mem_stats * counters[2] = {&mem_counters[tag], &mem_counters[MEM_TAGS]};
+    int i;
+    for(i = 0; i < 2; i++) {
+        counters[i]->live_bytes += size;
+        counters[i]->live_allocs += allocs;
+        if(allocs > 0) counters[i]->allocs += allocs;
+        if(counters[i]->live_bytes > counters[i]->peak_bytes) counters[i]->peak_bytes = counters[i]->live_bytes;
+    }
+}
+
 /* Malloc wrapper to track allocations. Aborts program on failure */
-void * xmalloc(size_t size) {
+void * pman_xmalloc(size_t size, mem_tag tag) {
     assert(size);
-    void * tmp = malloc(size);
+    mem_header * tmp = malloc(sizeof(mem_header) + size);
     if(!tmp) { //unrecoverable error, if this fails, something is very wrong
         perror("FATAL: A malloc failed: "); // Note this behavior is acceptable for a stand alone program
         abort();                            // but would be insufficient for a library
     }
-    return tmp;
+    tmp->size = size;
+    tmp->tag = tag;
+    mem_count(tag, size, 1);
+    return tmp + 1;
 }
 
-/* Realloc function to track reallocations. Aborts program on failure */
-void * xrealloc(void * ptr, size_t size) {
+/* Realloc function to track reallocations, the block keeps the tag it was
+ * allocated with. Aborts program on failure */
+void * pman_xrealloc(void * ptr, size_t size, mem_tag tag) {
     assert(size);
-    void * tmp = realloc(ptr,size);
+    if(!ptr) return pman_xmalloc(size, tag);
+    mem_header * header = (mem_header *) ptr - 1;
+    size_t old_size = header->size;
+    mem_header * tmp = realloc(header, sizeof(mem_header) + size);
     if(!tmp) { //unrecoverable error, if this fails, something is very wrong
         perror("FATAL: A realloc failed: "); // Note this behavior is acceptable for a stand alone program
         abort();                             // but would be insufficient for a library 
     }
-    return tmp;
+    tmp->size = size;
+    mem_count(tmp->tag, (long) size - (long) old_size, 0);
+    return tmp + 1;
 }
 
-/* Free wrapper to track freeing memory */
-void xfree(void * ptr) {
+/* Free wrapper to track freeing memory, only for blocks from the wrappers */
+void pman_xfree(void * ptr) {
     assert(ptr);
-    free(ptr);
+    mem_header * header = (mem_header *) ptr - 1;
+    assert(header->tag < MEM_TAGS);
+    mem_count(header->tag, -(long) header->size, -1);
+    free(header);
+}
+
+/* Fill stats with the counters of tag, MEM_TAGS for the totals */
+void mem_get_stats(mem_tag tag, mem_stats * stats) {
+    *stats = mem_counters[tag];
+}
+
+/* Name of a tag, for printing */
+const char * mem_tag_name(mem_tag tag) {
+    return mem_tag_names[tag];
 }
 
 /* Takes a string and attempts to convert it to a valid pid
@@ -52,62 +99,104 @@ int extract_pid(char * pid){
 /* Specialized memory freeing function for tokens from get_tokens()*/
 void free_tokens(char ** tokens) {
     if(!tokens) return;
-    char * * buff = tokens;
-    while(*buff) {
-        xfree(*buff);
-        buff++;
+    xfree(tokens); //pointers and strings share one allocation
+}
+
+/* Reads the token starting at *line, skipping leading spaces. Single quotes
+ * keep everything literally, double quotes allow \" and \\, a backslash
+ * outside quotes escapes any character. An unclosed quote ends at the line end.
+ * Copies the token into out unless it is NULL and moves *line past it
+ * Returns the token length, -1 if there are no more tokens
+ */
+static int next_token(const char * * line, char * out) {
+    const char * pos = *line;
+    while( *pos && isspace((unsigned char) *pos) ) pos++;
+    if( !(*pos) ) {
+        *line = pos;
+        return -1;
+    }
+
+    int len = 0;
+    char quote = 0; //quote currently open
+    while( *pos && (quote || !isspace((unsigned char) *pos)) ) {
+        char c = *pos++;
+        if( quote == '\'' ) {
+            if( c == '\'' ) {
+                quote = 0;
+                continue;
+            }
+        } else if( c == '\\' && *pos && (!quote || *pos == '"' || *pos == '\\') ) {
+            c = *pos++;
+        } else if( c == '"' && quote ) {
+            quote = 0;
+            continue;
+        } else if( (c == '"' || c == '\'') && !quote ) {
+            quote = c;
+            continue;
+        }
+        if(out) out[len] = c;
+        len++;
     }
-    xfree(tokens);
+
+    if(out) out[len] = 0;
+    *line = pos;
+    return len;
 }
 
 /* Takes an input line and formats it into tokens
  * Returns an array of null terminated strings when tokens
  * Return null if there are no tokens
+ * The array and the strings are one allocation, the line is not modified
  * Caller is expected to use free_tokens to cleanup
  */
 char * * get_tokens(char * line) {
-    int tokens_size = 10;
-    char ** tokens = xmalloc(sizeof(char *) * tokens_size);
-
-    int token_index = 0; //where to place next token
-    while( *line) { //break into tokens
-
-        while( *line && isspace(*line) ) line++;
-        if( !(*line) ) break;
-
-        if (token_index == tokens_size - 1) { //room for null
-            tokens_size *= 2;
-            tokens = xrealloc(tokens, sizeof(char *) * tokens_size);
-        }
-
-        int token_size = 10;
-        char * token = xmalloc(sizeof(char*) * token_size);
-        int letter_index = 0;
-        while( *line && !isspace(*line)) {
-            if( letter_index == token_size - 1 ) {
-                token_size *= 2;
-                char * tmp = realloc(token, sizeof(char) * token_size);
-                assert(tmp);
-                token = tmp;
-            }
-            token[letter_index] = *line;
-            letter_index++;
-            line++;
-        }
-
-        token[letter_index] = 0;
-        token = xrealloc(token, (letter_index + 1 ) * sizeof(char)); //reduce unused memory
-
-        tokens[token_index] = token;
-        token_index++;
+    //each token takes at least one character and a space, so the pointers are bounded
+    //by half the line. Quotes and escapes only shrink tokens, so the strings fit the line
+    size_t len = strlen(line);
+    size_t pointers = sizeof(char *) * ((len + 1) / 2 + 1);
+    char * * tokens = xmalloc(pointers + len + 1);
+    char * arena = (char *) tokens + pointers;
+
+    const char * pos = line;
+    int num = 0;
+    int token_len;
+    while( (token_len = next_token(&pos, arena)) >= 0 ) {
+        tokens[num++] = arena;
+        arena += token_len + 1;
     }
 
-    if( token_index == 0) {
+    if( num == 0) {
         xfree(tokens);
         return NULL;
-    } else {
-        tokens[token_index] = NULL;
-        tokens = realloc(tokens, (token_index + 1)*sizeof(char*)); //save space
-        return tokens;
     }
+    tokens[num] = NULL;
+    return tokens;
+}
+
+/* Monotonic time in seconds */
+double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Copies a null terminated array of tokens into a single allocation
+ * Caller is expected to use free_tokens for cleanup
+ */
+char * * copy_tokens(char * * tokens) {
+    int num = 0;
+    size_t len = 0;
+    while(tokens[num]) len += strlen(tokens[num++]) + 1;
+
+    char * * copy = xmalloc(sizeof(char *) * (num + 1) + len); //pointers, then the strings
+    char * strings = (char *) (copy + num + 1);
+    int i;
+    for(i = 0; i < num; i++) {
+        copy[i] = strings;
+        strcpy(strings, tokens[i]);
+        strings += strlen(tokens[i]) + 1;
+    }
+    copy[num] = NULL;
+    return copy;
 }
@@ -5,14 +5,52 @@
 
 #include <stdio.h>
 
+/* Tags for what an allocation is for. A file sets its tag by defining
+ * MEM_TAG before its includes, one call can pass another to xmalloc_tagged */
+typedef enum mem_tag {
+    MEM_OTHER,
+    MEM_TOKENS,  //tokenized commands and arguement files
+    MEM_JOBS,    //job records, tables, names, groups and queued jobs
+    MEM_STATS,   ///proc results and ptop rows
+    MEM_OUTPUT,  //command output and control socket buffers
+    MEM_CAPTURE, //captured job output
+    MEM_TAGS
+} mem_tag;
+
+#ifndef MEM_TAG
+#define MEM_TAG MEM_OTHER
+#endif
+
+/* Struct for the allocation counters of one tag */
+typedef struct mem_stats {
+    long live_bytes;
+    long live_allocs;
+    long peak_bytes; //most live bytes at once
+    long allocs; //calls to xmalloc, and xrealloc of NULL, since start
+} mem_stats;
+
+/* The wrappers are macros so each call site passes its tag, and so
+ * libraries like readline keep their own xmalloc and xfree symbols */
+#define xmalloc(size) pman_xmalloc((size), MEM_TAG)
+#define xmalloc_tagged(size, tag) pman_xmalloc((size), (tag))
+#define xrealloc(ptr, size) pman_xrealloc((ptr), (size), MEM_TAG)
+#define xfree(ptr) pman_xfree(ptr)
+
 /* Malloc wrapper to track allocations. Aborts program on failure */
-void * xmalloc(size_t size);
+void * pman_xmalloc(size_t size, mem_tag tag);
+
+/* Realloc function to track reallocations, the block keeps the tag it was
+ * allocated with. Aborts program on failure */
+void * pman_xrealloc(void * ptr, size_t size, mem_tag tag);
 
-/* Realloc function to track reallocations.  Aborts program on failure */
-void * xrealloc(void * ptr, size_t size);
+/* Free wrapper to track freeing memory, only for blocks from the wrappers */
+void pman_xfree(void * ptr);
 
-/* Free wrapper to track freeing memory */
-void xfree(void * ptr);
+/* Fill stats with the counters of tag, MEM_TAGS for the totals */
+void mem_get_stats(mem_tag tag, mem_stats * stats);
+
+/* Name of a tag, for printing */
+const char * mem_tag_name(mem_tag tag);
 
 /* Takes a string and attempts to convert it to a valid pid
  * Assumes the string is not empty, else behavior may be undefined
@@ -24,10 +62,20 @@ int extract_pid(char * pid);
 void free_tokens(char ** tokens);
 
 /* Takes an input line and formats it into tokens
+ * Tokens are split on spaces, 'single' and "double" quotes or a backslash
+ * keep spaces inside a token
  * Returns an array of null terminated strings when tokens
  * Return null if there are no tokens
- * Caller is expected to use free_tokens for cleanup
+ * Caller is expected to use free_tokens for cleanup (a single free)
  */
 char * * get_tokens(char * line);
 
+/* Copies a null terminated array of tokens into a single allocation
+ * Caller is expected to use free_tokens for cleanup
+ */
+char * * copy_tokens(char * * tokens);
+
+/* Monotonic time in seconds */
+double monotonic_seconds(void);
+
 #endif
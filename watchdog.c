@@ -0,0 +1,758 @@
+/* Watchdog implementation code */
+
+#define MEM_TAG MEM_JOBS
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "groups.h"
+#include "output.h"
+#include "procstat.h"
+#include "utils.h"
+#include "watchdog.h"
+
+#define WATCHDOG_INTERVAL 1000 //ms between samples unless --interval is given
+#define WATCHDOG_GRACE 5.0 //seconds between SIGTERM and SIGKILL
+#define WATCHDOG_LOG_SIZE 64 //breaches the watchdog command shows
+#define WATCHDOG_MAX_SKIP 8 //ticks a job well under its limits can go unsampled
+
+enum {OVER_RSS = 1, OVER_CPU = 2};
+
+/* Struct for the watchdog state of one job */
+typedef struct job_watch {
+    int own; //limits came with the job, otherwise the global ones apply
+    job_limits limits;
+    double time; //monotonic seconds of the last sample, 0 before it
+    unsigned long cpu; //utime + stime in clock ticks at the last sample
+    unsigned long rss_kb; //at the last sample
+    double cpu_percent; //since the previous sample
+    int over; //OVER_ bits of the limits it is over, acted on when set
+    double kill_at; //SIGKILL is due then after a SIGTERM, 0 for none
+    int skip; //ticks left before the next sample
+    int backoff; //ticks skipped after the last sample, doubles while far under
+} job_watch;
+
+/* Struct for the limits of a group as a whole */
+typedef struct group_watch {
+    struct group_watch * next;
+    jobgroup * group;
+    job_limits limits;
+    int events_fd; //memory.events, -1 without an rss limit
+    unsigned long long high_events; //"high" count last read from memory.events
+    double time;
+    unsigned long long usage_usec; //from cpu.stat at the last sample
+    double cpu_percent;
+    int over;
+    double kill_at;
+} group_watch;
+
+/* Struct for one logged breach */
+typedef struct breach {
+    time_t time;
+    pid_t pid; //0 for a group
+    char name[JOB_INLINE_NAME]; //@name for a group
+    const char * limit; //rss, cpu, or grace for a kill after SIGTERM
+    double value; //KB, percent or seconds
+    double max;
+    const char * action; //what was done
+} breach;
+
+static const char * action_names[] = {"log", "stop", "term", "kill"};
+
+static evloop * watch_loop = NULL;
+static jobtable * watch_jobs = NULL;
+static int timer_fd = -1;
+static int armed = 0;
+static int interval = WATCHDOG_INTERVAL;
+static job_limits global; //for jobs without their own limits
+static group_watch * group_watches = NULL;
+
+static void on_timer(int fd, unsigned int events, void * data);
+
+static breach breach_log[WATCHDOG_LOG_SIZE]; //a ring, oldest first from log_next
+static int log_next = 0;
+static unsigned long breaches = 0;
+
+/* Set limits to none, terminating jobs over them */
+void watchdog_limits_init(job_limits * limits) {
+    limits->max_rss_kb = 0;
+    limits->max_cpu = 0;
+    limits->action = LIMIT_TERM;
+}
+
+/* Watch jobs of jobs, the timer is dispatched from loop */
+void watchdog_init(evloop * loop, jobtable * jobs) {
+    watch_loop = loop;
+    watch_jobs = jobs;
+    watchdog_limits_init(&global);
+}
+
+/* Checks if limits set any limit */
+static int limits_set(const job_limits * limits) {
+    return limits->max_rss_kb || limits->max_cpu > 0;
+}
+
+/* Takes a size like 2G, 512M, 64K or bytes, units are powers of 1024
+ * Returns: -1 if invalid or under 1K, 0 otherwise */
+static int parse_size(const char * text, unsigned long * kb) {
+    char * end;
+    double size = strtod(text, &end);
+    if(end == text || size <= 0) return -1;
+    double scale = 1.0 / 1024;
+    switch(*end) {
+        case 'k': case 'K': scale = 1; end++; break;
+        case 'm': case 'M': scale = 1024; end++; break;
+        case 'g': case 'G': scale = 1024.0 * 1024; end++; break;
+        case 't': case 'T': scale = 1024.0 * 1024 * 1024; end++; break;
+    }
+    if(*end == 'i' && end[1] == 'B') end += 2;
+    else if(*end == 'B') end++;
+    if(*end || size * scale < 1) return -1;
+    *kb = size * scale;
+    return 0;
+}
+
+/* Summary: Parses one limit option of bg
+ * Description: --max-rss size (2G, 512M), --max-cpu percent of one cpu
+ * (90%, over 100 for several threads) or --on-limit log|stop|term|kill
+ * Takes:
+ *        args: the option, then its value
+ *        limits: limits to update
+ * Returns: number of arguements used, 0 if args[0] is not a limit
+ * option, -1 on an invalid value (the error is printed) */
+int watchdog_parse_option(char * * args, job_limits * limits) {
+    const char * option = args[0];
+    const char * value = args[1];
+    if(strcmp(option, "--max-rss") != 0 && strcmp(option, "--max-cpu") != 0
+       && strcmp(option, "--on-limit") != 0) return 0;
+    if(!value) {
+        out_printf("Missing value for %s\n", option);
+        return -1;
+    }
+
+    if(strcmp(option, "--max-rss") == 0) {
+        if(parse_size(value, &limits->max_rss_kb) < 0) {
+            out_printf("Invalid size %s, use a size like 2G, 512M or 64K\n", value);
+            return -1;
+        }
+    } else if(strcmp(option, "--max-cpu") == 0) {
+        char * end;
+        limits->max_cpu = strtod(value, &end);
+        if(end == value || limits->max_cpu <= 0 || (*end && strcmp(end, "%") != 0)) {
+            out_printf("Invalid cpu limit %s, use a percent of one cpu like 90%%\n", value);
+            return -1;
+        }
+    } else {
+        int i;
+        for(i = 0; i < (int) (sizeof(action_names) / sizeof(action_names[0])); i++) {
+            if(strcmp(value, action_names[i]) == 0) break;
+        }
+        if(i == (int) (sizeof(action_names) / sizeof(action_names[0]))) {
+            out_printf("Invalid action %s, use log, stop, term or kill\n", value);
+            return -1;
+        }
+        limits->action = i;
+    }
+    return 2;
+}
+
+/* Starts or stops the sample timer, it is created on first use
+ * Returns: -1 on failure (errno set), 0 otherwise */
+static int arm(int on) {
+    if(on == armed) return 0;
+    if(timer_fd < 0) {
+        if(!on) return 0;
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(timer_fd < 0) return -1;
+        if(evloop_add(watch_loop, timer_fd, EPOLLIN, on_timer, NULL) < 0) {
+            close(timer_fd);
+            timer_fd = -1;
+            return -1;
+        }
+    }
+
+    struct itimerspec spec = {0}; //all zero disarms
+    if(on) {
+        spec.it_interval.tv_sec = interval / 1000;
+        spec.it_interval.tv_nsec = (interval % 1000) * 1000000L;
+        spec.it_value = spec.it_interval;
+    }
+    if(timerfd_settime(timer_fd, 0, &spec, NULL) < 0) return -1;
+    armed = on;
+    return 0;
+}
+
+/* Arms the timer for a new watch, reporting a failure on stderr since
+ * it can happen while a job starts */
+static void arm_or_warn(void) {
+    if(arm(1) < 0) perror("Warning. Starting the watchdog timer failed, limits are not enforced");
+}
+
+/* Starts watching a new job, with its own limits when they set any,
+ * otherwise under the global limits. limits may be NULL */
+void watchdog_add(subprogram * job, const job_limits * limits) {
+    if(limits && limits_set(limits)) {
+        job_watch * watch = xmalloc(sizeof(job_watch));
+        memset(watch, 0, sizeof(job_watch));
+        watch->own = 1;
+        watch->limits = *limits;
+        watch->time = monotonic_seconds(); //a new process starts with no cpu time
+        job->watch = watch;
+    } else if(!limits_set(&global)) {
+        return;
+    }
+    arm_or_warn();
+}
+
+/* Unit of the values of a limit, for printing */
+static const char * limit_unit(const char * limit) {
+    if(strcmp(limit, "rss") == 0) return "KB";
+    return strcmp(limit, "cpu") == 0 ? "%" : "s";
+}
+
+/* Adds a breach to the log and reports it on stderr, since it happens
+ * between commands */
+static void log_breach(pid_t pid, const char * name, const char * limit, double value, double max,
+                       const char * action) {
+    breach * entry = &breach_log[log_next];
+    log_next = (log_next + 1) % WATCHDOG_LOG_SIZE;
+    breaches++;
+    entry->time = time(NULL);
+    entry->pid = pid;
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    entry->limit = limit;
+    entry->value = value;
+    entry->max = max;
+    entry->action = action;
+
+    if(pid) fprintf(stderr, "pman: %s(pid=%d) ", name, pid);
+    else fprintf(stderr, "pman: group %s ", name);
+    if(strcmp(limit, "grace") == 0) {
+        fprintf(stderr, "still running %.0fs after SIGTERM: %s\n", value, action);
+    } else {
+        int digits = strcmp(limit, "cpu") == 0; //percents are rounded, a breach must not look equal
+        fprintf(stderr, "over its %s limit (%.*f%s, limit %.0f%s): %s\n", limit, digits, value, limit_unit(limit),
+                max, limit_unit(limit), action);
+    }
+}
+
+/* Name of what was done for an action, or of why it failed */
+static const char * action_done(limit_action action, int failed) {
+    static const char * done[] = {"logged", "stopped", "terminated", "killed"};
+    return failed ? "signal failed" : done[action];
+}
+
+/* Acts on a job over its limits, crossed are the OVER_ bits newly set */
+static void job_breached(subprogram * job, job_watch * watch, const job_limits * limits, int crossed,
+                         double now) {
+    int failed = 0;
+    if(limits->action == LIMIT_STOP) {
+        failed = job_signal(job, SIGSTOP) < 0;
+    } else if(limits->action == LIMIT_TERM) {
+        failed = job_signal(job, SIGTERM) < 0;
+        if(!failed && !watch->kill_at) watch->kill_at = now + WATCHDOG_GRACE;
+    } else if(limits->action == LIMIT_KILL) {
+        failed = job_signal(job, SIGKILL) < 0;
+    }
+    const char * done = action_done(limits->action, failed);
+    if(crossed & OVER_RSS) log_breach(job->pid, job->name, "rss", watch->rss_kb, limits->max_rss_kb, done);
+    if(crossed & OVER_CPU) log_breach(job->pid, job->name, "cpu", watch->cpu_percent, limits->max_cpu, done);
+}
+
+/* Acts on a group over its limits, crossed are the OVER_ bits newly set */
+static void group_breached(group_watch * gwatch, int crossed, unsigned long rss_kb, double now) {
+    jobgroup * group = gwatch->group;
+    int failed = 0;
+    if(gwatch->limits.action == LIMIT_STOP) {
+        failed = group_freeze(group, 1, NULL) < 0;
+    } else if(gwatch->limits.action == LIMIT_TERM) {
+        failed = group_signal(group, SIGTERM) < 0;
+        if(!failed && !gwatch->kill_at) gwatch->kill_at = now + WATCHDOG_GRACE;
+    } else if(gwatch->limits.action == LIMIT_KILL) {
+        failed = group_kill(group, NULL) < 0;
+    }
+    const char * done = action_done(gwatch->limits.action, failed);
+    char name[GROUP_NAME_SIZE + 1];
+    snprintf(name, sizeof(name), "@%s", group->name);
+    if(crossed & OVER_RSS) log_breach(0, name, "rss", rss_kb, gwatch->limits.max_rss_kb, done);
+    if(crossed & OVER_CPU) log_breach(0, name, "cpu", gwatch->cpu_percent, gwatch->limits.max_cpu, done);
+}
+
+/* Checks if a sample is under half of every limit set */
+static int far_under(const job_watch * watch, const job_limits * limits) {
+    if(limits->max_rss_kb && watch->rss_kb > limits->max_rss_kb / 2) return 0;
+    if(limits->max_cpu > 0 && watch->cpu_percent > limits->max_cpu / 2) return 0;
+    return 1;
+}
+
+/* Summary: Samples one job under limits
+ * Description: One read of /proc/pid/stat gives the rss and the cpu time,
+ * cpu use is the difference with the previous sample. Each limit is
+ * acted on when the job crosses it, not again while it stays over. A job
+ * far under its limits is sampled less often, the ticks skipped double up
+ * to WATCHDOG_MAX_SKIP, and a sample nearer a limit samples every tick again
+ * Takes:
+ *        job: the job, running
+ *        limits: its own or the global limits
+ *        now: monotonic seconds of this sample */
+static void sample_job(subprogram * job, const job_limits * limits, double now) {
+    procstat stats;
+    char buffer[PROCSTAT_BUFFER_SIZE];
+    if(procstat_read_stat(job->pid, &stats, buffer, sizeof(buffer)) < 0) return; //exited, reaped soon
+
+    job_watch * watch = job->watch;
+    if(!watch) { //under the global limits, cpu use is known from the next sample
+        watch = xmalloc(sizeof(job_watch));
+        memset(watch, 0, sizeof(job_watch));
+        job->watch = watch;
+    }
+    unsigned long cpu = stats.utime + stats.stime;
+    int had_sample = watch->time > 0;
+    watch->rss_kb = stats.rss * (sysconf(_SC_PAGESIZE) / 1024);
+    watch->cpu_percent = 0;
+    if(watch->time > 0 && now > watch->time) {
+        watch->cpu_percent = (cpu - watch->cpu) / (double) sysconf(_SC_CLK_TCK) / (now - watch->time) * 100;
+    }
+    watch->time = now;
+    watch->cpu = cpu;
+    if(stats.state == 'Z') return; //exited, waiting to be reaped
+
+    int over = 0;
+    if(limits->max_rss_kb && watch->rss_kb > limits->max_rss_kb) over |= OVER_RSS;
+    if(limits->max_cpu > 0 && watch->cpu_percent > limits->max_cpu) over |= OVER_CPU;
+    int crossed = over & ~watch->over;
+    watch->over = over;
+    if(crossed) job_breached(job, watch, limits, crossed, now);
+
+    if(!had_sample || over || watch->kill_at || !far_under(watch, limits)) watch->backoff = 0;
+    else if(watch->backoff < WATCHDOG_MAX_SKIP) watch->backoff = watch->backoff ? watch->backoff * 2 : 1;
+    watch->skip = watch->backoff;
+}
+
+/* Reads an open cgroup file from its start into buffer, null terminated
+ * Returns: -1 on failure, 0 otherwise */
+static int read_open_file(int fd, char * buffer, int size) {
+    int len = pread(fd, buffer, size - 1, 0);
+    if(len < 0) return -1;
+    buffer[len] = 0;
+    return 0;
+}
+
+/* Reads file of the cgroup directory dir into buffer, null terminated
+ * Returns: -1 on failure, 0 otherwise */
+static int read_cgroup_file(int dir, const char * file, char * buffer, int size) {
+    int fd = openat(dir, file, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return -1;
+    int ret = read_open_file(fd, buffer, size);
+    close(fd);
+    return ret;
+}
+
+/* Value of key in a flat keyed cgroup file like cpu.stat, 0 if missing */
+static unsigned long long cgroup_key(const char * buffer, const char * key) {
+    int len = strlen(key);
+    const char * line;
+    for(line = buffer; line && *line; line = strchr(line, '\n'), line = line ? line + 1 : NULL) {
+        if(strncmp(line, key, len) == 0 && line[len] == ' ') return strtoull(line + len + 1, NULL, 10);
+    }
+    return 0;
+}
+
+/* Memory of a group in KB from memory.current, 0 if it can not be read */
+static unsigned long group_rss_kb(group_watch * gwatch) {
+    char buffer[64];
+    if(read_cgroup_file(gwatch->group->cgroup_fd, "memory.current", buffer, sizeof(buffer)) < 0) return 0;
+    return strtoull(buffer, NULL, 10) / 1024;
+}
+
+/* Summary: Samples a group under limits
+ * Description: cpu use is the difference of usage_usec in cpu.stat with
+ * the previous sample. Memory is not sampled, memory.events reports
+ * breaches; memory.current is only read while the group is over, to
+ * know when it is back under its limit
+ * Takes:
+ *        gwatch: the group
+ *        now: monotonic seconds of this sample */
+static void sample_group(group_watch * gwatch, double now) {
+    int over = gwatch->over & OVER_RSS;
+    if(over && group_rss_kb(gwatch) <= gwatch->limits.max_rss_kb) over = 0;
+
+    char buffer[1024];
+    if(gwatch->limits.max_cpu > 0
+       && read_cgroup_file(gwatch->group->cgroup_fd, "cpu.stat", buffer, sizeof(buffer)) == 0) {
+        unsigned long long usage = cgroup_key(buffer, "usage_usec");
+        gwatch->cpu_percent = 0;
+        if(gwatch->time > 0 && now > gwatch->time && usage >= gwatch->usage_usec) {
+            gwatch->cpu_percent = (usage - gwatch->usage_usec) / 1e4 / (now - gwatch->time);
+        }
+        gwatch->time = now;
+        gwatch->usage_usec = usage;
+        if(gwatch->cpu_percent > gwatch->limits.max_cpu) over |= OVER_CPU;
+    }
+
+    int crossed = over & ~gwatch->over;
+    gwatch->over = over;
+    if(crossed) group_breached(gwatch, crossed, 0, now);
+}
+
+/* Event loop callback for memory.events of a group, a "high" count that
+ * grew means the group went over memory.high */
+static void on_memory_events(int fd, unsigned int events, void * data) {
+    (void) events;
+    group_watch * gwatch = (group_watch *) data;
+    char buffer[512];
+    if(read_open_file(fd, buffer, sizeof(buffer)) < 0) return;
+    unsigned long long high = cgroup_key(buffer, "high");
+    int grew = high > gwatch->high_events;
+    gwatch->high_events = high;
+    if(!grew || (gwatch->over & OVER_RSS)) return;
+
+    gwatch->over |= OVER_RSS;
+    group_breached(gwatch, OVER_RSS, group_rss_kb(gwatch), monotonic_seconds());
+    arm_or_warn(); //to see the group get back under
+}
+
+/* Summary: Samples everything under limits
+ * Description: Sends SIGKILL to what is still running after its grace,
+ * then samples jobs with limits and groups. The timer is disarmed when
+ * nothing is left to watch, a new watch arms it again */
+static void sample_all(void) {
+    double now = monotonic_seconds();
+    int watching = 0;
+
+    ADThashnode * node;
+    for(node = watch_jobs->active.head; node; node = node->next) {
+        subprogram * job = (subprogram *) node->val;
+        job_watch * watch = job->watch;
+        if(watch && watch->kill_at && now < watch->kill_at) {
+            watching++;
+        } else if(watch && watch->kill_at) {
+            watch->kill_at = 0;
+            int failed = job_signal(job, SIGKILL) < 0;
+            log_breach(job->pid, job->name, "grace", WATCHDOG_GRACE, WATCHDOG_GRACE, action_done(LIMIT_KILL, failed));
+        }
+
+        const job_limits * limits = watch && watch->own ? &watch->limits : &global;
+        if(!limits_set(limits)) continue;
+        watching++;
+        if(watch && watch->skip > 0) watch->skip--;
+        else sample_job(job, limits, now);
+    }
+
+    group_watch * gwatch;
+    for(gwatch = group_watches; gwatch; gwatch = gwatch->next) {
+        if(gwatch->kill_at && now >= gwatch->kill_at) {
+            gwatch->kill_at = 0;
+            if(gwatch->group->members) {
+                char name[GROUP_NAME_SIZE + 1];
+                snprintf(name, sizeof(name), "@%s", gwatch->group->name);
+                int failed = group_kill(gwatch->group, NULL) < 0;
+                log_breach(0, name, "grace", WATCHDOG_GRACE, WATCHDOG_GRACE, action_done(LIMIT_KILL, failed));
+            }
+        }
+        if(gwatch->limits.max_cpu > 0 || gwatch->over || gwatch->kill_at) {
+            watching++;
+            sample_group(gwatch, now);
+        }
+    }
+
+    if(!watching) arm(0);
+}
+
+/* Event loop callback for the sample timer */
+static void on_timer(int fd, unsigned int events, void * data) {
+    (void) events; (void) data;
+    unsigned long long expirations = 0;
+    if(read(fd, &expirations, sizeof(expirations)) < 0) return; //missed ticks are one sample
+    sample_all();
+}
+
+/* Samples jobs under the global limits from the next tick, they changed */
+static void wake_jobs(void) {
+    ADThashnode * node;
+    for(node = watch_jobs->active.head; node; node = node->next) {
+        job_watch * watch = ((subprogram *) node->val)->watch;
+        if(watch && !watch->own) watch->skip = watch->backoff = 0;
+    }
+}
+
+/* Limits of group, NULL if it has none */
+static group_watch * find_group_watch(jobgroup * group) {
+    group_watch * gwatch;
+    for(gwatch = group_watches; gwatch; gwatch = gwatch->next) {
+        if(gwatch->group == group) return gwatch;
+    }
+    return NULL;
+}
+
+/* Removes the limits of a group, its memory.high is set back to max */
+static void drop_group_watch(group_watch * gwatch) {
+    group_watch * * link = &group_watches;
+    while(*link != gwatch) link = &(*link)->next;
+    *link = gwatch->next;
+    if(gwatch->events_fd >= 0) {
+        evloop_remove(watch_loop, gwatch->events_fd);
+        close(gwatch->events_fd);
+        group_cgroup_write(gwatch->group, "memory.high", "max");
+    }
+    xfree(gwatch);
+}
+
+/* Summary: Sets the limits of a group as a whole
+ * Description: The rss limit becomes memory.high of the group's cgroup,
+ * so the kernel reclaims from the group above it and counts a "high"
+ * event that epoll reports through memory.events. The cpu limit is
+ * checked against cpu.stat on each sample. Limits given before are replaced
+ * Takes:
+ *        group: the group
+ *        limits: limits that set any
+ * Returns: -1 on failure (the error is printed), 0 otherwise */
+static int watch_group(jobgroup * group, const job_limits * limits) {
+    if(group->cgroup_fd < 0) {
+        out_printf("Group %s has no cgroup, give its jobs limits with bg --max-rss and --max-cpu\n", group->name);
+        return -1;
+    }
+    group_watch * old = find_group_watch(group);
+    if(old) drop_group_watch(old);
+
+    group_watch * gwatch = xmalloc(sizeof(group_watch));
+    memset(gwatch, 0, sizeof(group_watch));
+    gwatch->group = group;
+    gwatch->limits = *limits;
+    gwatch->events_fd = -1;
+
+    if(limits->max_rss_kb) {
+        char buffer[512];
+        snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long) limits->max_rss_kb * 1024);
+        int fd = openat(group->cgroup_fd, "memory.events", O_RDONLY | O_CLOEXEC);
+        if(fd < 0 || group_cgroup_write(group, "memory.high", buffer) < 0) {
+            out_printf("No memory limit for group %s (%s), the memory controller is not enabled for its cgroup\n",
+                       group->name, strerror(errno));
+            if(fd >= 0) close(fd);
+            xfree(gwatch);
+            return -1;
+        }
+        if(read_open_file(fd, buffer, sizeof(buffer)) < 0
+           || evloop_add(watch_loop, fd, EPOLLPRI, on_memory_events, gwatch) < 0) {
+            out_perror("Aborting. Watching memory.events failed");
+            group_cgroup_write(group, "memory.high", "max");
+            close(fd);
+            xfree(gwatch);
+            return -1;
+        }
+        gwatch->events_fd = fd;
+        gwatch->high_events = cgroup_key(buffer, "high"); //events before the limit are not breaches
+    }
+
+    gwatch->next = group_watches;
+    group_watches = gwatch;
+    if(limits->max_cpu > 0) arm_or_warn();
+    return 0;
+}
+
+/* Describes limits like rss 2097152KB, cpu 90%, on limit term */
+static void describe_limits(const job_limits * limits, char * text, int size) {
+    if(!limits_set(limits)) {
+        snprintf(text, size, "none");
+        return;
+    }
+    int len = 0;
+    if(limits->max_rss_kb) len += snprintf(text + len, size - len, "rss %luKB, ", limits->max_rss_kb);
+    if(limits->max_cpu > 0) len += snprintf(text + len, size - len, "cpu %.0f%%, ", limits->max_cpu);
+    snprintf(text + len, size - len, "on limit %s", action_names[limits->action]);
+}
+
+/* Adds a limits record, rss_kb and cpu are the last sample */
+static void limits_record(const char * scope, const char * name, pid_t pid, const job_limits * limits,
+                          unsigned long rss_kb, double cpu) {
+    out_record("limits");
+    out_field_str("scope", scope);
+    out_field_str("name", name);
+    out_field_int("pid", pid);
+    out_field_int("max_rss_kb", limits->max_rss_kb);
+    out_field_double("max_cpu", limits->max_cpu);
+    out_field_str("action", action_names[limits->action]);
+    out_field_int("rss_kb", rss_kb);
+    out_field_double("cpu", cpu);
+    out_end_record();
+}
+
+/* Summary: Prints the state of the watchdog
+ * Description: Whether it is sampling, the global limits, the limits of
+ * groups and of jobs started with their own, then the logged breaches.
+ * A watchdog record, limits records and breach records in json and tsv */
+static void print_watchdog(void) {
+    int human = out_get_format() == OUT_HUMAN;
+    int watched = 0;
+    ADThashnode * node;
+    for(node = watch_jobs->active.head; node; node = node->next) {
+        job_watch * watch = ((subprogram *) node->val)->watch;
+        if((watch && watch->own) || limits_set(&global)) watched++;
+    }
+
+    char text[128];
+    describe_limits(&global, text, sizeof(text));
+    if(human) {
+        out_printf("Watchdog: %s every %dms, %d jobs watched, %lu breaches\n"
+                   "Global limits: %s\n", armed ? "sampling" : "idle, samples", interval, watched, breaches, text);
+    } else {
+        out_record("watchdog");
+        out_field_int("sampling", armed);
+        out_field_int("interval", interval);
+        out_field_int("watched", watched);
+        out_field_int("breaches", breaches);
+        out_end_record();
+        limits_record("global", "", 0, &global, 0, 0);
+    }
+
+    group_watch * gwatch;
+    for(gwatch = group_watches; gwatch; gwatch = gwatch->next) {
+        describe_limits(&gwatch->limits, text, sizeof(text));
+        if(human) {
+            out_printf("Group @%s: %s%s, cpu %.1f%%\n", gwatch->group->name, text,
+                       gwatch->events_fd >= 0 ? " (memory.high)" : "", gwatch->cpu_percent);
+        } else {
+            limits_record("group", gwatch->group->name, 0, &gwatch->limits, 0, gwatch->cpu_percent);
+        }
+    }
+
+    for(node = watch_jobs->active.head; node; node = node->next) {
+        subprogram * job = (subprogram *) node->val;
+        if(!job->watch || !job->watch->own) continue;
+        job_watch * watch = job->watch;
+        describe_limits(&watch->limits, text, sizeof(text));
+        if(human) {
+            out_printf("%d  %s: %s, rss %luKB, cpu %.1f%%\n", job->pid, job->name, text, watch->rss_kb,
+                       watch->cpu_percent);
+        } else {
+            limits_record("job", job->name, job->pid, &watch->limits, watch->rss_kb, watch->cpu_percent);
+        }
+    }
+
+    int logged = breaches < WATCHDOG_LOG_SIZE ? breaches : WATCHDOG_LOG_SIZE;
+    if(human && logged) out_printf("Recent breaches:\n");
+    int i;
+    for(i = 0; i < logged; i++) {
+        breach * entry = &breach_log[(log_next - logged + i + WATCHDOG_LOG_SIZE) % WATCHDOG_LOG_SIZE];
+        if(!human) {
+            out_record("breach");
+            out_field_int("time", entry->time);
+            out_field_int("pid", entry->pid);
+            out_field_str("name", entry->name);
+            out_field_str("limit", entry->limit);
+            out_field_double("value", entry->value);
+            out_field_double("max", entry->max);
+            out_field_str("action", entry->action);
+            out_end_record();
+            continue;
+        }
+        char clock[16];
+        strftime(clock, sizeof(clock), "%H:%M:%S", localtime(&entry->time));
+        out_printf("  %s  ", clock);
+        if(entry->pid) out_printf("%s(pid=%d)", entry->name, entry->pid);
+        else out_printf("group %s", entry->name);
+        const char * unit = limit_unit(entry->limit);
+        if(strcmp(entry->limit, "grace") == 0) {
+            out_printf(" still running %.0fs after SIGTERM: %s\n", entry->value, entry->action);
+        } else {
+            out_printf(" %s %.*f%s, limit %.0f%s: %s\n", entry->limit, strcmp(entry->limit, "cpu") == 0,
+                       entry->value, unit, entry->max, unit, entry->action);
+        }
+    }
+}
+
+/* Summary: Runs the watchdog command
+ * Description: Limit options set the global limits, which apply to jobs
+ * started without their own, or with @group first the limits of the
+ * group as a whole. Options given replace all limits of their scope, off
+ * removes them. --interval sets ms between samples. Prints the state
+ * after, alone it only prints it
+ * Takes:
+ *       args: arguements after watchdog
+ * Returns: -1 on failure, 0 otherwise
+ */
+int watchdog_command(char * * args) {
+    const char * usage = "usage: watchdog [@group] [--max-rss size] [--max-cpu percent] [--on-limit action] "
+                         "[--interval ms] | watchdog [@group] off\n";
+    jobgroup * group = NULL;
+    if(args[0] && args[0][0] == '@') {
+        group = group_find(args[0] + 1, 0);
+        if(!group) {
+            out_printf("No group named %s\n", args[0] + 1);
+            return -1;
+        }
+        args++;
+    }
+
+    int ret = 0;
+    if(args[0] && strcmp(args[0], "off") == 0) {
+        if(args[1]) {
+            out_printf("Invalid arguements\n%s", usage);
+            return -1;
+        }
+        if(!group) watchdog_limits_init(&global);
+        else if(find_group_watch(group)) drop_group_watch(find_group_watch(group));
+    } else if(args[0]) {
+        job_limits limits;
+        watchdog_limits_init(&limits);
+        int given = 0;
+        int new_interval = 0;
+        while(*args) {
+            if(strcmp(args[0], "--interval") == 0) {
+                if(!args[1] || (new_interval = extract_pid(args[1])) < 10) {
+                    out_printf("Invalid interval, at least 10ms\n%s", usage);
+                    return -1;
+                }
+                args += 2;
+                continue;
+            }
+            int used = watchdog_parse_option(args, &limits);
+            if(used < 0) return -1;
+            if(!used) {
+                out_printf("Invalid arguements\n%s", usage);
+                return -1;
+            }
+            given = 1;
+            args += used;
+        }
+
+        if(new_interval && new_interval != interval) {
+            interval = new_interval;
+            if(armed) { //restarted at the new interval
+                armed = 0;
+                arm_or_warn();
+            }
+        }
+        if(given && group && limits_set(&limits)) {
+            ret = watch_group(group, &limits);
+        } else if(given && group) {
+            if(find_group_watch(group)) drop_group_watch(find_group_watch(group));
+        } else if(given) {
+            global = limits;
+            wake_jobs();
+            if(limits_set(&global) && watch_jobs->active.num) arm_or_warn();
+        }
+    }
+
+    print_watchdog();
+    return ret;
+}
+
+/* Stop watching, groups get their memory.high back */
+void watchdog_free(void) {
+    while(group_watches) drop_group_watch(group_watches);
+    if(timer_fd >= 0) {
+        evloop_remove(watch_loop, timer_fd);
+        close(timer_fd);
+        timer_fd = -1;
+        armed = 0;
+    }
+}
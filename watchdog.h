@@ -0,0 +1,59 @@
+/* Watchdog header. Jobs started with --max-rss or --max-cpu, and every
+ * job while global limits are set, are sampled from /proc/pid/stat on a
+ * timer in the event loop, which is only armed while something is
+ * watched. Limits on a group with a cgroup cover the group as a whole:
+ * its memory limit becomes memory.high and breaches arrive through
+ * memory.events, its cpu use is one read of cpu.stat. A breach is logged,
+ * or the job or group is stopped, terminated (killed if it is still
+ * running after a grace period) or killed. A job far under its limits is
+ * sampled less often. PSI triggers are not used: they report stalls of a
+ * cgroup, not the rss or cpu use of a job, and need a cgroup per job */
+
+#ifndef _WATCHDOG_H
+#define _WATCHDOG_H
+
+#include "evloop.h"
+#include "jobs.h"
+
+/* What is done to a job over a limit */
+typedef enum limit_action {
+    LIMIT_LOG,
+    LIMIT_STOP, //SIGSTOP, or a frozen cgroup
+    LIMIT_TERM, //SIGTERM, SIGKILL after WATCHDOG_GRACE seconds
+    LIMIT_KILL
+} limit_action;
+
+/* Struct for the limits of a job, a group or all jobs */
+typedef struct job_limits {
+    unsigned long max_rss_kb; //0 for no limit
+    double max_cpu; //percent of one cpu over a sample interval, 0 for no limit
+    limit_action action;
+} job_limits;
+
+/* Watch jobs of jobs, the timer is dispatched from loop */
+void watchdog_init(evloop * loop, jobtable * jobs);
+
+/* Set limits to none, terminating jobs over them */
+void watchdog_limits_init(job_limits * limits);
+
+/* Summary: Parses one limit option of bg: --max-rss size (2G, 512M),
+ * --max-cpu percent (90%) or --on-limit log|stop|term|kill
+ * Takes:
+ *        args: the option, then its value
+ *        limits: limits to update
+ * Returns: number of arguements used, 0 if args[0] is not a limit
+ * option, -1 on an invalid value (the error is printed) */
+int watchdog_parse_option(char * * args, job_limits * limits);
+
+/* Starts watching a new job, with its own limits when they set any,
+ * otherwise under the global limits. limits may be NULL */
+void watchdog_add(subprogram * job, const job_limits * limits);
+
+/* Runs the watchdog command, args after watchdog
+ * Returns: -1 on failure, 0 otherwise */
+int watchdog_command(char * * args);
+
+/* Stop watching, groups get their memory.high back */
+void watchdog_free(void);
+
+#endif